@@ -0,0 +1,151 @@
+#ifndef BOOK_MANAGER_H
+#define BOOK_MANAGER_H
+
+#include "limit_order_book.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// Order books for many instruments, keyed by a dense symbol id
+//
+// Every book keeps its own sequential ids, so each one still indexes its orders densely and no counter
+// is shared between books or threads. The id space is split into one power of two range per symbol and
+// a book's local id is offset into its symbol's range, making ids unique across every book and letting
+// cancels and updates be routed from the id alone:
+// global id = (symbol << id_bits) | local id
+//
+// Symbols are sharded across matcher threads by symbol % shard_count. A manager only holds the books of
+// its own shard and is only ever touched by that shard's thread
+template <typename Book = LimitOrderBook>
+class BookManager final {
+    private:
+        const uint32_t symbol_count;
+        const uint32_t shard;
+        const uint32_t shard_count;
+        const int id_bits;
+        std::vector<std::unique_ptr<Book>> books;  // Indexed by symbol, nullptr for other shards' symbols
+
+        inline int _to_local(const int id) const {
+            return int(uint32_t(id) & uint32_t((int64_t(1) << id_bits) - 1));
+        }
+
+        // Rejects orders once a symbol has used up its id range
+        inline bool _has_ids(const Book &book) const {
+            return book.get_next_order_id() < (int64_t(1) << id_bits);
+        }
+
+    public:
+        // Bits of a global id holding the local id, order ids are non-negative 32 bit ints
+        static inline int id_bits_for(const uint32_t symbol_count) {
+            int symbol_bits = 0;
+            while ((uint32_t(1) << symbol_bits) < symbol_count) {
+                symbol_bits++;
+            }
+            return 31 - symbol_bits;
+        }
+
+        static inline uint32_t shard_of(const uint32_t symbol, const uint32_t shard_count) {
+            return symbol % shard_count;
+        }
+
+        // Any trailing arguments are passed to every book's constructor
+        template <typename... BookArgs>
+        BookManager(const uint32_t _symbol_count, const uint32_t _shard = 0, const uint32_t _shard_count = 1, BookArgs&&... book_args)
+            : symbol_count(_symbol_count),
+              shard(_shard),
+              shard_count(_shard_count),
+              id_bits(id_bits_for(_symbol_count)),
+              books(_symbol_count) {
+            if (symbol_count == 0 || symbol_count > (uint32_t(1) << 16) || shard_count == 0 || shard >= shard_count) {
+                throw std::invalid_argument("BookManager requires 1 to 65536 symbols and shard < shard_count");
+            }
+
+            for (uint32_t symbol = shard; symbol < symbol_count; symbol += shard_count) {
+                books[symbol] = std::make_unique<Book>(book_args...);
+            }
+        }
+
+        BookManager(const BookManager&) = delete;
+        BookManager& operator=(const BookManager&) = delete;
+
+        inline uint32_t get_symbol_count() const {
+            return symbol_count;
+        }
+
+        // Symbol owning a global order id, symbol_count for ids no symbol could have issued
+        inline uint32_t symbol_of(const int id) const {
+            const uint32_t symbol = uint32_t(id) >> id_bits;
+            return (id < 0 || symbol >= symbol_count) ? symbol_count : symbol;
+        }
+
+        // Global id of a book local id such as a fill's order ids, -1 stays -1
+        inline int to_global(const uint32_t symbol, const int local_id) const {
+            return (local_id < 0) ? -1 : int((symbol << id_bits) | uint32_t(local_id));
+        }
+
+        inline bool owns(const uint32_t symbol) const {
+            return symbol < symbol_count && books[symbol] != nullptr;
+        }
+
+        // nullptr when the symbol belongs to another shard or does not exist
+        inline Book* find(const uint32_t symbol) {
+            return (symbol < symbol_count) ? books[symbol].get() : nullptr;
+        }
+
+        // Visits (symbol, book) for every book held by this shard
+        template <typename Visitor>
+        inline void for_each(Visitor visit) {
+            for (uint32_t symbol = shard; symbol < symbol_count; symbol += shard_count) {
+                visit(symbol, *books[symbol]);
+            }
+        }
+
+        inline int bid(const uint32_t symbol, const int quantity, const int price, const OrderType order_type, const int trader_id) {
+            Book *book = find(symbol);
+            if (book == nullptr || !_has_ids(*book)) {
+                return -1;
+            }
+            return to_global(symbol, (order_type == OrderType::market) ? book->market_bid(quantity, trader_id) : book->bid(quantity, price, order_type, trader_id));
+        }
+
+        inline int ask(const uint32_t symbol, const int quantity, const int price, const OrderType order_type, const int trader_id) {
+            Book *book = find(symbol);
+            if (book == nullptr || !_has_ids(*book)) {
+                return -1;
+            }
+            return to_global(symbol, (order_type == OrderType::market) ? book->market_ask(quantity, trader_id) : book->ask(quantity, price, order_type, trader_id));
+        }
+
+        // Returns false if the order isn't open in this shard or belongs to another trader
+        inline bool cancel(const int id, const int trader_id) {
+            Book *book = find(symbol_of(id));
+            return book != nullptr && book->cancel(_to_local(id), trader_id);
+        }
+
+        inline bool update(const int id, const int quantity, const int trader_id) {
+            Book *book = find(symbol_of(id));
+            return book != nullptr && book->update(_to_local(id), quantity, trader_id);
+        }
+
+        // The order keeps its id and symbol, returns -1 if it could not be replaced
+        inline int replace(const int id, const int price, const int quantity, const int trader_id) {
+            Book *book = find(symbol_of(id));
+            if (book == nullptr) {
+                return -1;
+            }
+            return (book->replace(_to_local(id), price, quantity, trader_id) < 0) ? -1 : id;
+        }
+
+        // Cancels a trader's open orders in every book of this shard, returns the number cancelled
+        inline size_t cancel_all(const int trader_id) {
+            size_t cancelled = 0;
+            for_each([&cancelled, trader_id](uint32_t, Book &book) {
+                cancelled += book.cancel_all(trader_id);
+            });
+            return cancelled;
+        }
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef BOOK_TYPES_H
+#define BOOK_TYPES_H
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+// Integer widths of a book's prices, quantities and order ids, passed to BasicLimitOrderBook as one policy
+// All three must be signed, -1 marks a missing price or id. Trader ids are always int
+template <typename Price, typename Quantity, typename Id>
+struct BookTypes {
+    static_assert(std::is_integral<Price>::value && std::is_signed<Price>::value, "Prices must be a signed integer type");
+    static_assert(std::is_integral<Quantity>::value && std::is_signed<Quantity>::value, "Quantities must be a signed integer type");
+    static_assert(std::is_integral<Id>::value && std::is_signed<Id>::value, "Order ids must be a signed integer type");
+
+    using price_type = Price;
+    using quantity_type = Quantity;
+    using id_type = Id;
+};
+
+// 32 bit everything, the layout used by the bindings, the server and the wire protocol
+using DefaultBookTypes = BookTypes<int32_t, int32_t, int32_t>;
+// 16 bit ticks for dense simulations on a narrow price band
+using CompactBookTypes = BookTypes<int16_t, int32_t, int32_t>;
+// 64 bit everything, for long replays which run past 2^31 order ids
+using WideBookTypes = BookTypes<int64_t, int64_t, int64_t>;
+
+#endif
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "limit_order_book.hpp"
+
+// Command: c++ -O3 -Wall -std=c++17 engine_benchmark.cpp -o engine_benchmark
+// Usage: ./engine_benchmark [operations per scenario] [seed]
+
+// Replays seeded synthetic order flows against both price containers, and the map with 64 bit types
+// Each flow is generated up front and replayed twice on fresh books, once untimed per operation for
+// throughput and once with a clock read around every operation for the latency percentiles
+
+enum class Action : uint8_t {
+    limit,
+    market,
+    cancel,
+    update
+};
+
+struct Operation {
+    Action action;
+    bool is_bid;
+    int quantity;
+    int price;
+    int target;  // Order id for cancel and update, ids are handed out in submission order
+};
+
+// Builds a flow, tracking the id each submitted order will receive
+class FlowBuilder final {
+    private:
+        std::vector<Operation> operations;
+        int next_id = 0;
+
+    public:
+        std::mt19937_64 rng;
+
+        explicit FlowBuilder(const uint64_t seed) : rng(seed) {}
+
+        inline int uniform(const int low, const int high) {
+            return std::uniform_int_distribution<int>(low, high)(rng);
+        }
+
+        inline bool chance(const double probability) {
+            return std::bernoulli_distribution(probability)(rng);
+        }
+
+        // One of the last window ids, many of which will already have left the book
+        inline int recent_id(const int window) {
+            return (next_id == 0) ? 0 : std::max(0, next_id - 1 - uniform(0, window - 1));
+        }
+
+        inline void limit(const bool is_bid, const int quantity, const int price) {
+            operations.push_back({Action::limit, is_bid, quantity, price, 0});
+            next_id++;
+        }
+
+        inline void market(const bool is_bid, const int quantity) {
+            operations.push_back({Action::market, is_bid, quantity, 0, 0});
+            next_id++;
+        }
+
+        inline void cancel(const int id) {
+            operations.push_back({Action::cancel, false, 0, 0, id});
+        }
+
+        inline void update(const int id, const int quantity) {
+            operations.push_back({Action::update, false, quantity, 0, id});
+        }
+
+        inline std::vector<Operation> take() {
+            return std::move(operations);
+        }
+};
+
+const int mid_price = 30000;
+
+// The README scenario, every order at price 1 so only one level ever exists
+std::vector<Operation> simple_flow(const size_t count, const uint64_t seed) {
+    FlowBuilder flow(seed);
+    for (size_t i = 0; i < count; i++) {
+        flow.limit(i < count / 2, 1, 1);
+    }
+    return flow.take();
+}
+
+// Passive orders spread over ~1000 levels each side of a drifting mid, a few cross the spread
+std::vector<Operation> deep_book_flow(const size_t count, const uint64_t seed) {
+    FlowBuilder flow(seed);
+    int mid = mid_price;
+
+    for (size_t i = 0; i < count; i++) {
+        mid = std::clamp(mid + flow.uniform(-1, 1), 2000, 60000);
+        const bool is_bid = flow.chance(0.5);
+        const int offset = flow.chance(0.05) ? -flow.uniform(0, 5) : flow.uniform(1, 1000);
+        flow.limit(is_bid, flow.uniform(1, 100), (is_bid) ? mid - offset : mid + offset);
+    }
+    return flow.take();
+}
+
+// Most messages cancel a recent order, as market makers requote
+std::vector<Operation> cancel_heavy_flow(const size_t count, const uint64_t seed) {
+    FlowBuilder flow(seed);
+
+    for (size_t i = 0; i < count; i++) {
+        if (flow.chance(0.6)) {
+            flow.cancel(flow.recent_id(4096));
+            continue;
+        }
+        const bool is_bid = flow.chance(0.5);
+        const int offset = flow.chance(0.05) ? -flow.uniform(0, 3) : flow.uniform(1, 50);
+        flow.limit(is_bid, flow.uniform(1, 100), (is_bid) ? mid_price - offset : mid_price + offset);
+    }
+    return flow.take();
+}
+
+// Small resting orders on every tick, regularly swept by market orders that clear dozens of levels
+std::vector<Operation> sweep_flow(const size_t count, const uint64_t seed) {
+    FlowBuilder flow(seed);
+
+    for (size_t i = 0; i < count; i++) {
+        const bool is_bid = flow.chance(0.5);
+        if (i % 64 == 63) {
+            flow.market(is_bid, flow.uniform(200, 400));
+            continue;
+        }
+        const int offset = flow.uniform(1, 200);
+        flow.limit(is_bid, flow.uniform(1, 10), (is_bid) ? mid_price - offset : mid_price + offset);
+    }
+    return flow.take();
+}
+
+// Updates to recent orders, increases move the order to the back of its level
+std::vector<Operation> update_flow(const size_t count, const uint64_t seed) {
+    FlowBuilder flow(seed);
+
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0 && flow.chance(0.5)) {
+            flow.update(flow.recent_id(4096), flow.uniform(1, 200));
+            continue;
+        }
+        const bool is_bid = flow.chance(0.5);
+        const int offset = flow.uniform(1, 20);
+        flow.limit(is_bid, flow.uniform(1, 100), (is_bid) ? mid_price - offset : mid_price + offset);
+    }
+    return flow.take();
+}
+
+template <typename Book>
+inline void apply(Book &book, const Operation &operation) {
+    switch (operation.action) {
+        case Action::limit:
+            if (operation.is_bid) {
+                book.bid(operation.quantity, operation.price, OrderType::limit, 0);
+            } else {
+                book.ask(operation.quantity, operation.price, OrderType::limit, 0);
+            }
+            break;
+        case Action::market:
+            if (operation.is_bid) {
+                book.market_bid(operation.quantity, 0);
+            } else {
+                book.market_ask(operation.quantity, 0);
+            }
+            break;
+        case Action::cancel:
+            book.cancel(operation.target, 0);
+            break;
+        case Action::update:
+            book.update(operation.target, operation.quantity, 0);
+            break;
+    }
+}
+
+template <typename Book>
+void run(const char *scenario, const char *book_name, const std::vector<Operation> &operations) {
+    double seconds;
+    {
+        Book book(operations.size(), 0);
+        const auto start = std::chrono::steady_clock::now();
+        for (const Operation &operation : operations) {
+            apply(book, operation);
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::vector<uint32_t> latencies(operations.size());
+    {
+        Book book(operations.size(), 0);
+        for (size_t i = 0; i < operations.size(); i++) {
+            const auto start = std::chrono::steady_clock::now();
+            apply(book, operations[i]);
+            latencies[i] = uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](const double p) { return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))]; };
+
+    std::printf("%-14s %-8s %10zu %9.2f %7u %7u %7u %9u\n", scenario, book_name, operations.size(), operations.size() / seconds / 1e6,
+        percentile(0.5), percentile(0.99), percentile(0.999), latencies.back());
+}
+
+int main(int argc, char **argv) {
+    const size_t count = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    const uint64_t seed = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 1;
+
+    struct Scenario {
+        const char *name;
+        std::vector<Operation> (*build)(size_t, uint64_t);
+    };
+    const Scenario scenarios[] = {
+        {"simple", simple_flow},
+        {"deep_book", deep_book_flow},
+        {"cancel_heavy", cancel_heavy_flow},
+        {"sweep", sweep_flow},
+        {"update", update_flow}
+    };
+
+    // Latencies include one steady_clock read, typically ~20 ns
+    std::printf("%-14s %-8s %10s %9s %7s %7s %7s %9s\n", "scenario", "book", "ops", "Mops/s", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+    for (const Scenario &scenario : scenarios) {
+        const std::vector<Operation> operations = scenario.build(count, seed);
+        run<BasicLimitOrderBook<MapPriceLevels, NullFillSink>>(scenario.name, "map", operations);
+        run<BasicLimitOrderBook<LadderPriceLevels, NullFillSink>>(scenario.name, "ladder", operations);
+        run<BasicLimitOrderBook<MapPriceLevels, NullFillSink, WideBookTypes>>(scenario.name, "map64", operations);
+    }
+    return 0;
+}
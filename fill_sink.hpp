@@ -0,0 +1,184 @@
+#ifndef FILL_SINK_H
+#define FILL_SINK_H
+
+#include "book_types.hpp"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// One fill, a plain aggregate so fills can be copied into rings and NumPy arrays byte for byte
+template <typename Types>
+struct BasicTransaction {
+    int trader_one;  // Taker, the trader of the incoming order
+    int trader_two;  // Maker, the trader of the resting order
+    typename Types::price_type price;
+    typename Types::quantity_type quantity;
+    typename Types::id_type taker_order_id;  // Book local ids of the incoming and the resting order
+    typename Types::id_type maker_order_id;
+
+    std::string to_str() const {
+        return "Transaction(taker_id=" + std::to_string(trader_one) + ", maker_id=" + std::to_string(trader_two) + ", quantity=" + std::to_string(quantity) + ", price=" + std::to_string(price)
+            + ", taker_order_id=" + std::to_string(taker_order_id) + ", maker_order_id=" + std::to_string(maker_order_id) + ")";
+    }
+};
+
+using Transaction = BasicTransaction<DefaultBookTypes>;
+
+static_assert(std::is_trivially_copyable<Transaction>::value && std::is_standard_layout<Transaction>::value && sizeof(Transaction) == 24,
+    "Transaction is copied as raw bytes by SpscFillRing and the bindings");
+
+// New aggregate quantity resting at one price, 0 once the level has emptied
+template <typename Types>
+struct BasicLevelUpdate {
+    typename Types::price_type price;
+    typename Types::quantity_type quantity;
+    bool is_bid;
+};
+
+using LevelUpdate = BasicLevelUpdate<DefaultBookTypes>;
+
+// Fill sinks receive every Transaction from the matching loop through on_fill(const Transaction&)
+// The sink is a template parameter of the book so the call is resolved and inlined at compile time
+// Sinks which also define on_level_update(const LevelUpdate&) are told every time a level's quantity
+// changes, books with other sinks skip the level bookkeeping entirely
+// Books with other BookTypes pass BasicTransaction and BasicLevelUpdate of those types instead
+
+template <typename Sink, typename Update = LevelUpdate, typename = void>
+struct has_level_updates : std::false_type {};
+
+template <typename Sink, typename Update>
+struct has_level_updates<Sink, Update, std::void_t<decltype(std::declval<Sink&>().on_level_update(std::declval<const Update&>()))>> : std::true_type {};
+
+// Discards fills, for books where only the resting state matters, works with any BookTypes
+struct NullFillSink {
+    template <typename Fill>
+    inline void on_fill(const Fill&) {}
+};
+
+// Keeps every fill until cleared, memory grows with the number of fills between clear() calls
+template <typename Types = DefaultBookTypes>
+class BasicVectorFillSink final {
+    public:
+        using Transaction = BasicTransaction<Types>;
+
+        std::vector<Transaction> transactions;
+
+        inline void on_fill(const Transaction &transaction) {
+            transactions.push_back(transaction);
+        }
+
+        inline void clear() {
+            // Capacity is kept so a sink drained regularly stops reallocating
+            transactions.clear();
+        }
+};
+
+using VectorFillSink = BasicVectorFillSink<>;
+
+// Keeps fills and level updates until cleared, for feeding market data after each event
+class MarketDataSink final {
+    public:
+        std::vector<Transaction> transactions;
+        std::vector<LevelUpdate> level_updates;
+
+        inline void on_fill(const Transaction &transaction) {
+            transactions.push_back(transaction);
+        }
+
+        inline void on_level_update(const LevelUpdate &update) {
+            level_updates.push_back(update);
+        }
+
+        inline void clear() {
+            transactions.clear();
+            level_updates.clear();
+        }
+};
+
+// Hands each fill to a callable inline on the matching thread, works with any BookTypes
+template <typename Callback>
+class CallbackFillSink final {
+    private:
+        Callback callback;
+
+    public:
+        explicit CallbackFillSink(Callback _callback) : callback(std::move(_callback)) {}
+
+        template <typename Fill>
+        inline void on_fill(const Fill &transaction) {
+            callback(transaction);
+        }
+};
+
+// Bounded single producer single consumer ring, the matching thread pushes and one other thread drains
+// Memory is fixed at Capacity fills, when the ring is full the matching thread waits for the drain
+template <size_t Capacity = 65536>
+class SpscFillRing final {
+    private:
+        static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscFillRing capacity must be a power of two");
+        static constexpr size_t mask = Capacity - 1;
+
+        std::unique_ptr<Transaction[]> slots{new Transaction[Capacity]};
+
+        // Producer and consumer positions live on separate cache lines, each side caches the other's
+        alignas(64) std::atomic<size_t> head{0};
+        size_t cached_tail = 0;
+        alignas(64) std::atomic<size_t> tail{0};
+        size_t cached_head = 0;
+
+    public:
+        SpscFillRing() = default;
+        SpscFillRing(const SpscFillRing&) = delete;
+        SpscFillRing& operator=(const SpscFillRing&) = delete;
+
+        // Producer side, called by the book
+        inline void on_fill(const Transaction &transaction) {
+            const size_t position = head.load(std::memory_order_relaxed);
+
+            while (position - cached_tail == Capacity) {
+                cached_tail = tail.load(std::memory_order_acquire);
+                if (position - cached_tail == Capacity) {
+                    std::this_thread::yield();
+                }
+            }
+
+            slots[position & mask] = transaction;
+            head.store(position + 1, std::memory_order_release);
+        }
+
+        // Consumer side, visits every fill published so far and returns how many were drained
+        template <typename Visitor>
+        inline size_t drain(Visitor visit) {
+            const size_t position = tail.load(std::memory_order_relaxed);
+            cached_head = head.load(std::memory_order_acquire);
+
+            for (size_t i = position; i != cached_head; i++) {
+                visit(slots[i & mask]);
+            }
+
+            tail.store(cached_head, std::memory_order_release);
+            return cached_head - position;
+        }
+
+        inline bool try_pop(Transaction &transaction) {
+            const size_t position = tail.load(std::memory_order_relaxed);
+
+            if (position == cached_head) {
+                cached_head = head.load(std::memory_order_acquire);
+                if (position == cached_head) {
+                    return false;
+                }
+            }
+
+            transaction = slots[position & mask];
+            tail.store(position + 1, std::memory_order_release);
+            return true;
+        }
+};
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Append-only, memory mapped journal of fixed size records
+//
+// The file is a 64 byte header followed by the records in the order they were appended. Records are
+// copied into the mapping as they arrive and only become part of the journal once commit() has synced
+// them and then advanced the committed count in the header, so a crash mid-batch loses the uncommitted
+// tail rather than leaving a torn record. The file grows in chunks, the committed count, not the file
+// size, says where the records end. A failed sync throws and leaves the count where it was, so records
+// are never reported committed unless they reached the disk
+
+struct JournalHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t committed;   // Records synced to disk
+    uint64_t user_tag;    // Set by the owner, e.g. to refuse replaying a journal into the wrong shard
+    uint8_t padding[32];
+};
+
+static_assert(sizeof(JournalHeader) == 64, "JournalHeader must be 64 bytes");
+
+constexpr char journal_magic[8] = {'C', 'P', 'P', 'L', 'O', 'B', 'J', 'N'};
+constexpr uint32_t journal_version = 1;
+
+template <typename Record>
+class JournalWriter final {
+    private:
+        static_assert(std::is_trivially_copyable<Record>::value, "Journal records are copied as raw bytes");
+
+        int fd = -1;
+        unsigned char *map = nullptr;
+        size_t mapped = 0;
+        size_t grow_bytes;
+        uint64_t appended = 0;   // Records written to the mapping, committed or not
+        uint64_t committed = 0;
+
+        inline JournalHeader* _header() const {
+            return reinterpret_cast<JournalHeader*>(map);
+        }
+
+        inline void _map(const size_t bytes) {
+            if (map != nullptr) {
+                munmap(map, mapped);
+                map = nullptr;
+            }
+            if (ftruncate(fd, off_t(bytes)) != 0) {
+                throw std::runtime_error("Could not grow journal");
+            }
+
+            void *address = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (address == MAP_FAILED) {
+                throw std::runtime_error("Could not map journal");
+            }
+            map = static_cast<unsigned char*>(address);
+            mapped = bytes;
+        }
+
+    public:
+        // Opens the journal at path, appending after any records already committed
+        explicit JournalWriter(const std::string &path, const uint64_t user_tag = 0, const size_t _grow_bytes = size_t(64) << 20)
+            : grow_bytes(_grow_bytes) {
+            fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (fd < 0) {
+                throw std::runtime_error("Could not open journal " + path);
+            }
+
+            struct stat info;
+            if (fstat(fd, &info) != 0) {
+                throw std::runtime_error("Could not read the size of journal " + path);
+            }
+            const bool fresh = (size_t(info.st_size) < sizeof(JournalHeader));
+            _map(fresh ? sizeof(JournalHeader) + grow_bytes : size_t(info.st_size));
+
+            if (fresh) {
+                JournalHeader header{};
+                std::memcpy(header.magic, journal_magic, sizeof(journal_magic));
+                header.version = journal_version;
+                header.record_size = sizeof(Record);
+                header.user_tag = user_tag;
+                std::memcpy(map, &header, sizeof(header));
+                if (msync(map, sizeof(header), MS_SYNC) != 0) {
+                    throw std::runtime_error("Could not sync journal " + path);
+                }
+            } else if (std::memcmp(_header()->magic, journal_magic, sizeof(journal_magic)) != 0
+                    || _header()->version != journal_version || _header()->record_size != sizeof(Record) || _header()->user_tag != user_tag) {
+                throw std::runtime_error("Journal " + path + " was written with a different format or owner");
+            }
+
+            appended = committed = _header()->committed;
+        }
+
+        JournalWriter(const JournalWriter&) = delete;
+        JournalWriter& operator=(const JournalWriter&) = delete;
+
+        ~JournalWriter() {
+            try {
+                commit();
+            } catch (const std::runtime_error&) {
+                // The uncommitted tail is dropped, as after a crash
+            }
+            munmap(map, mapped);
+            close(fd);
+        }
+
+        inline uint64_t size() const {
+            return committed;
+        }
+
+        // Copies records into the mapping, they are durable after the next commit()
+        inline void append(const Record *records, const size_t count) {
+            const size_t needed = sizeof(JournalHeader) + (appended + count) * sizeof(Record);
+            if (needed > mapped) {
+                _map(std::max(needed, mapped + grow_bytes));
+            }
+
+            std::memcpy(map + sizeof(JournalHeader) + appended * sizeof(Record), records, count * sizeof(Record));
+            appended += count;
+        }
+
+        // Syncs every appended record, then publishes them by syncing the committed count
+        // Throws if either sync fails, the records stay uncommitted and a later commit retries them
+        inline void commit() {
+            if (appended == committed) {
+                return;
+            }
+
+            // msync needs a page aligned start
+            const size_t page = size_t(sysconf(_SC_PAGESIZE));
+            const size_t first = (sizeof(JournalHeader) + committed * sizeof(Record)) & ~(page - 1);
+            const size_t last = sizeof(JournalHeader) + appended * sizeof(Record);
+            if (msync(map + first, last - first, MS_SYNC) != 0) {
+                throw std::runtime_error("Could not sync journal records");
+            }
+
+            _header()->committed = appended;
+            if (msync(map, sizeof(JournalHeader), MS_SYNC) != 0) {
+                _header()->committed = committed;
+                throw std::runtime_error("Could not sync journal header");
+            }
+            committed = appended;
+        }
+};
+
+// Read only view of a journal's committed records
+template <typename Record>
+class JournalReader final {
+    private:
+        int fd = -1;
+        const unsigned char *map = nullptr;
+        size_t mapped = 0;
+        uint64_t count = 0;
+
+    public:
+        // A missing journal reads as empty
+        explicit JournalReader(const std::string &path, const uint64_t user_tag = 0) {
+            fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return;
+            }
+
+            struct stat info;
+            if (fstat(fd, &info) != 0) {
+                throw std::runtime_error("Could not read the size of journal " + path);
+            }
+            if (size_t(info.st_size) < sizeof(JournalHeader)) {
+                return;
+            }
+
+            void *address = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (address == MAP_FAILED) {
+                throw std::runtime_error("Could not map journal " + path);
+            }
+            map = static_cast<const unsigned char*>(address);
+            mapped = size_t(info.st_size);
+
+            // Replay reads the records front to back exactly once
+            madvise(address, mapped, MADV_SEQUENTIAL);
+
+            const JournalHeader *header = reinterpret_cast<const JournalHeader*>(map);
+            if (std::memcmp(header->magic, journal_magic, sizeof(journal_magic)) != 0 || header->version != journal_version
+                    || header->record_size != sizeof(Record) || header->user_tag != user_tag) {
+                throw std::runtime_error("Journal " + path + " was written with a different format or owner");
+            }
+            count = std::min<uint64_t>(header->committed, (mapped - sizeof(JournalHeader)) / sizeof(Record));
+        }
+
+        JournalReader(const JournalReader&) = delete;
+        JournalReader& operator=(const JournalReader&) = delete;
+
+        ~JournalReader() {
+            if (map != nullptr) {
+                munmap(const_cast<unsigned char*>(map), mapped);
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        inline uint64_t size() const {
+            return count;
+        }
+
+        // Records start on a multiple of their size after the 64 byte header, so they are read in place
+        template <typename Visitor>
+        inline void for_each(Visitor visit) const {
+            const Record *records = reinterpret_cast<const Record*>(map + sizeof(JournalHeader));
+            for (uint64_t i = 0; i < count; i++) {
+                visit(records[i]);
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Hot path latency histograms
+//
+// Each thread records into its own set of histograms, one per stage, so recording is a timestamp, a
+// bucket lookup and an uncontended relaxed store with no locks or shared cache lines. Readers merge
+// every thread's histograms on demand, so a summary taken while threads are recording may miss the
+// values recorded during the merge.
+//
+// Buckets are HDR style: exact below 128 ns, then 64 linear sub-buckets per power of two, so every
+// reported value is within 1/64 (~1.6%) of the true one, up to 2^40 ns (~18 minutes).
+//
+// Build with -DCPPLOB_LATENCY_STATS=0 to compile every timestamp and record away
+
+#ifndef CPPLOB_LATENCY_STATS
+#define CPPLOB_LATENCY_STATS 1
+#endif
+
+constexpr bool latency_stats_enabled = (CPPLOB_LATENCY_STATS != 0);
+
+enum class LatencyStage : uint8_t {
+    receive,   // WebSocket message read until its event is published to the ring
+    queue,     // Event published until the matcher takes it off the ring
+    match,     // Matcher applying the event to its book
+    fill,      // WebSocket message read until a fill for it is emitted
+    reply,     // WebSocket message read until a reply is handed to its session, includes the journal sync
+    book,      // Book calls made through the Python bindings
+    count
+};
+
+constexpr const char* latency_stage_names[size_t(LatencyStage::count)] = {"receive", "queue", "match", "fill", "reply", "book"};
+
+// Timestamps are TSC ticks on x86, which are invariant and synchronised across cores on current CPUs,
+// so stages may start on one thread and end on another. Other hosts use steady_clock nanoseconds
+inline uint64_t latency_ticks() {
+    if constexpr (!latency_stats_enabled) {
+        return 0;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Measured once against steady_clock, the first call takes ~10 ms
+inline double latency_ns_per_tick() {
+#if defined(__x86_64__) || defined(__i386__)
+    static const double ns_per_tick = [] {
+        const auto clock_start = std::chrono::steady_clock::now();
+        const uint64_t tick_start = __rdtsc();
+        while (std::chrono::steady_clock::now() - clock_start < std::chrono::milliseconds(10)) {}
+        const double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - clock_start).count());
+        return ns / double(__rdtsc() - tick_start);
+    }();
+    return ns_per_tick;
+#else
+    return 1.0;
+#endif
+}
+
+struct LatencySummary {
+    uint64_t count;
+    double mean;
+    uint64_t min;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+class LatencyHistogram final {
+    public:
+        static constexpr size_t linear_buckets = 128;
+        static constexpr size_t sub_buckets = 64;
+        static constexpr size_t bucket_count = linear_buckets + 33 * sub_buckets;
+        static constexpr uint64_t highest_value = (uint64_t(1) << 40) - 1;
+
+    private:
+        std::array<std::atomic<uint64_t>, bucket_count> counts{};
+        std::atomic<uint64_t> total{0};
+
+    public:
+        static inline size_t index_of(uint64_t value) {
+            value = std::min(value, highest_value);
+            if (value < linear_buckets) {
+                return size_t(value);
+            }
+            const int shift = 63 - __builtin_clzll(value) - 6;
+            return linear_buckets + size_t(shift - 1) * sub_buckets + size_t(value >> shift) - sub_buckets;
+        }
+
+        // Highest value counted by a bucket, so percentiles never understate the tail
+        static inline uint64_t value_at(const size_t index) {
+            if (index < linear_buckets) {
+                return index;
+            }
+            const int shift = int((index - linear_buckets) / sub_buckets) + 1;
+            const uint64_t sub_bucket = (index - linear_buckets) % sub_buckets + sub_buckets;
+            return ((sub_bucket + 1) << shift) - 1;
+        }
+
+        // Only the owning thread may record
+        inline void record(const uint64_t ns) {
+            std::atomic<uint64_t> &bucket = counts[index_of(ns)];
+            bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            total.store(total.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        }
+
+        // Adds this histogram's counts to merged, which must hold bucket_count values
+        inline void merge_into(std::vector<uint64_t> &merged, uint64_t &sum) const {
+            for (size_t i = 0; i < bucket_count; i++) {
+                merged[i] += counts[i].load(std::memory_order_relaxed);
+            }
+            sum += total.load(std::memory_order_relaxed);
+        }
+
+        // Safe to call while the owner records, a value recorded at the same time may survive the reset
+        inline void reset() {
+            for (std::atomic<uint64_t> &bucket : counts) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+            total.store(0, std::memory_order_relaxed);
+        }
+
+        static inline LatencySummary summarise(const std::vector<uint64_t> &counts, const uint64_t sum) {
+            LatencySummary summary{};
+            for (const uint64_t count : counts) {
+                summary.count += count;
+            }
+            if (summary.count == 0) {
+                return summary;
+            }
+            summary.mean = double(sum) / double(summary.count);
+
+            const double quantiles[4] = {0.5, 0.9, 0.99, 0.999};
+            uint64_t *results[4] = {&summary.p50, &summary.p90, &summary.p99, &summary.p999};
+            size_t next = 0;
+            uint64_t seen = 0;
+            bool found_min = false;
+            for (size_t i = 0; i < counts.size(); i++) {
+                if (counts[i] == 0) {
+                    continue;
+                }
+                if (!found_min) {
+                    summary.min = value_at(i);
+                    found_min = true;
+                }
+                seen += counts[i];
+                while (next < 4 && double(seen) >= quantiles[next] * double(summary.count)) {
+                    *results[next++] = value_at(i);
+                }
+                summary.max = value_at(i);
+            }
+            return summary;
+        }
+};
+
+// Every thread's histograms, created on a thread's first record and kept for the life of the process
+// so a summary can still read them after the thread exits
+class LatencyStats final {
+    private:
+        struct ThreadHistograms {
+            std::array<LatencyHistogram, size_t(LatencyStage::count)> stages;
+        };
+
+        std::mutex mutex;  // Guards the list, never taken while recording
+        std::vector<std::unique_ptr<ThreadHistograms>> threads;
+
+        inline ThreadHistograms& _local() {
+            thread_local ThreadHistograms *local = nullptr;
+            if (local == nullptr) {
+                std::lock_guard<std::mutex> lock(mutex);
+                threads.push_back(std::make_unique<ThreadHistograms>());
+                local = threads.back().get();
+            }
+            return *local;
+        }
+
+    public:
+        static inline LatencyStats& instance() {
+            static LatencyStats stats;
+            return stats;
+        }
+
+        inline void record(const LatencyStage stage, const uint64_t start_ticks, const uint64_t end_ticks) {
+            if constexpr (latency_stats_enabled) {
+                const uint64_t ticks = (end_ticks > start_ticks) ? end_ticks - start_ticks : 0;
+                _local().stages[size_t(stage)].record(uint64_t(double(ticks) * latency_ns_per_tick()));
+            }
+        }
+
+        inline LatencySummary summary(const LatencyStage stage) {
+            std::vector<uint64_t> merged(LatencyHistogram::bucket_count, 0);
+            uint64_t sum = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (const auto &thread : threads) {
+                    thread->stages[size_t(stage)].merge_into(merged, sum);
+                }
+            }
+            return LatencyHistogram::summarise(merged, sum);
+        }
+
+        inline void reset() {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto &thread : threads) {
+                for (LatencyHistogram &histogram : thread->stages) {
+                    histogram.reset();
+                }
+            }
+        }
+};
+
+// Records the time since start_ticks, or nothing when stats are compiled out
+inline void record_latency(const LatencyStage stage, const uint64_t start_ticks) {
+    if constexpr (latency_stats_enabled) {
+        LatencyStats::instance().record(stage, start_ticks, latency_ticks());
+    }
+}
+
+#endif
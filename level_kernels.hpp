@@ -0,0 +1,77 @@
+#ifndef LEVEL_KERNELS_H
+#define LEVEL_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define LEVEL_KERNELS_AVX2 1
+#endif
+
+// Reductions over the contiguous per-price quantities of LadderPriceLevels
+// The AVX2 versions are compiled with a target attribute and picked at runtime, so the plain
+// c++ -O3 builds documented in the README use them on any x86-64 host which has AVX2
+
+template <typename Quantity>
+inline int64_t sum_quantities_scalar(const Quantity *values, const size_t count) {
+    int64_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += values[i];
+    }
+    return total;
+}
+
+#ifdef LEVEL_KERNELS_AVX2
+
+__attribute__((target("avx2"))) inline int64_t _horizontal_sum_avx2(const __m256i lanes) {
+    const __m128i pairs = _mm_add_epi64(_mm256_castsi256_si128(lanes), _mm256_extracti128_si256(lanes, 1));
+    return _mm_cvtsi128_si64(_mm_add_epi64(pairs, _mm_unpackhi_epi64(pairs, pairs)));
+}
+
+// 32 bit quantities are widened to 64 bit lanes so a sum over any number of levels can't overflow
+__attribute__((target("avx2"))) inline int64_t sum_quantities_avx2(const int32_t *values, const size_t count) {
+    __m256i low = _mm256_setzero_si256();
+    __m256i high = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+        low = _mm256_add_epi64(low, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(block)));
+        high = _mm256_add_epi64(high, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(block, 1)));
+    }
+    return _horizontal_sum_avx2(_mm256_add_epi64(low, high)) + sum_quantities_scalar(values + i, count - i);
+}
+
+__attribute__((target("avx2"))) inline int64_t sum_quantities_avx2(const int64_t *values, const size_t count) {
+    __m256i first = _mm256_setzero_si256();
+    __m256i second = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        first = _mm256_add_epi64(first, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i)));
+        second = _mm256_add_epi64(second, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i + 4)));
+    }
+    return _horizontal_sum_avx2(_mm256_add_epi64(first, second)) + sum_quantities_scalar(values + i, count - i);
+}
+
+inline bool has_avx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#endif
+
+// Sum of values[0, count), other quantity widths always take the scalar loop
+template <typename Quantity>
+inline int64_t sum_quantities(const Quantity *values, const size_t count) {
+#ifdef LEVEL_KERNELS_AVX2
+    if constexpr (std::is_same<Quantity, int32_t>::value || std::is_same<Quantity, int64_t>::value) {
+        if (count >= 8 && has_avx2()) {
+            return sum_quantities_avx2(values, count);
+        }
+    }
+#endif
+    return sum_quantities_scalar(values, count);
+}
+
+#endif
@@ -1,296 +1,875 @@
 #ifndef LIMIT_ORDER_BOOK_H
 #define LIMIT_ORDER_BOOK_H
 
-#include "doubly_linked_list.hpp"
+#include "fill_sink.hpp"
+#include "object_pool.hpp"
+#include "order_index.hpp"
+#include "order_queue.hpp"
+#include "price_levels.hpp"
+#include "snapshot.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
 #include <map>
-#include <unordered_map>
+#include <memory_resource>
 #include <iostream>
 #include <vector>
 #include <string>
+#include <utility>
+
+// One order of a batch submitted through submit_batch, laid out to match the NumPy dtype used by the bindings
+struct OrderRequest {
+    uint8_t side;        // 0 for a bid, 1 for an ask
+    uint8_t order_type;  // OrderType value, market orders ignore price
+    int32_t quantity;
+    int32_t price;
+    int32_t trader_id;
+    int32_t stop_price;  // Stop and stop limit orders only
+};
+
+// What happens when an order would trade against a resting order of the same trader
+enum class SelfTradePrevention : uint8_t {
+    none,           // The orders trade
+    cancel_newest,  // The rest of the incoming order is cancelled
+    cancel_oldest,  // The resting order is cancelled and matching carries on
+    cancel_both     // Both are cancelled
+};
 
-struct Transaction {
-    const int trader_one;
-    const int trader_two;
-    const int price;
-    const int quantity;
+template <typename Types>
+class BasicLimitLevel final {
+    public:
+        using price_type = typename Types::price_type;
+        using quantity_type = typename Types::quantity_type;
+        using Order = BasicOrder<Types>;
+
+        price_type price;
+        OrderQueue<Order> orders;
+        quantity_type quantity = 0;
+
+        BasicLimitLevel(const price_type _price, ObjectPool<OrderBlock<Order>> *block_pool, std::pmr::memory_resource *resource)
+            : price(_price), orders(block_pool, resource) {}
+
+        // Readies an emptied level for reuse at another price
+        inline void reset(const price_type _price) {
+            price = _price;
+            quantity = 0;
+            orders.clear();
+        }
 
-    Transaction (const int _trader_one, const int _trader_two, const int _price, const int _quantity)
-        : trader_one(_trader_one), trader_two(_trader_two), price(_price), quantity(_quantity) {}
+        // Returns the order's position in the queue
+        inline uint32_t append(const Order &order) {
+            quantity += order.quantity;
+            return orders.push_back(order);
+        }
 
-    std::string to_str() {
-        return "Transaction(maker_id=" + std::to_string(trader_one) + ", taker_id=" + std::to_string(trader_two) + ", quantity=" + std::to_string(quantity) + ", price=" + std::to_string(price) +  ")";
-    }
+        inline int get_length() const {
+            return int(orders.size());
+        }
 };
 
-class LimitLevel final {
+using LimitLevel = BasicLimitLevel<DefaultBookTypes>;
+
+// PriceLevels selects the price container for each side, see price_levels.hpp
+// FillSink receives every fill from the matching loop, see fill_sink.hpp
+// Types sets the integer widths of prices, quantities and order ids, see book_types.hpp. Every structure
+// of the book is sized from it, so a narrower book packs more orders and levels into each cache line
+template <template <typename> class PriceLevels, typename FillSink = VectorFillSink, typename Types = DefaultBookTypes>
+class BasicLimitOrderBook final {
     public:
-        const int price;
-        DoublyLinkedList orders;
-        int quantity;
+        using price_type = typename Types::price_type;
+        using quantity_type = typename Types::quantity_type;
+        using id_type = typename Types::id_type;
+        using Level = BasicLimitLevel<Types>;
+        using Levels = PriceLevels<Level>;
+        using Transaction = BasicTransaction<Types>;
+        using LevelUpdate = BasicLevelUpdate<Types>;
 
-        LimitLevel(Order *order) : price(order->price), quantity(order->quantity) {
-            orders.append(order);
+    private:
+        using Price = price_type;
+        using Quantity = quantity_type;
+        using Id = id_type;
+        using Order = BasicOrder<Types>;
+        using Block = OrderBlock<Order>;
+        using Location = OrderLocation<Types>;
+
+        static constexpr Price max_price = std::numeric_limits<Price>::max();
+
+        FillSink fill_sink;
+
+        // Order blocks and levels are recycled through these pools so steady state flow never touches the heap
+        ObjectPool<Block> block_pool;
+        ObjectPool<Level> level_pool;
+        // Backs the tree nodes of MapPriceLevels and the levels' block tables, freed nodes are kept for reuse rather than returned to the heap
+        std::pmr::unsynchronized_pool_resource node_resource;
+        std::vector<Level*> spare_levels;
+
+        Levels bids;
+        Levels asks;
+        OrderIndex<Types> orders;
+
+        // Pending stop orders keyed by (trigger, id). The trigger is the stop price for buys and its negation for
+        // sells, so on both sides the stops a trade sets off sit at the front in trigger then arrival order
+        using StopKey = std::pair<Price, Id>;
+        struct StopOrder {
+            Order order;
+            Price price;  // Limit price once triggered, unused by stop orders
+        };
+        std::pmr::map<StopKey, StopOrder> bid_stops;
+        std::pmr::map<StopKey, StopOrder> ask_stops;
+
+        Id order_id = 0;
+        Price last_price = -1;  // Price of the last fill, -1 before the first
+        SelfTradePrevention self_trade_prevention = SelfTradePrevention::none;
+
+        // Reports a level's new aggregate quantity to its side's container and to sinks which want level updates
+        inline void _level_changed(const bool is_bid, const Price price, const Quantity quantity) {
+            _get_side(is_bid)->set_quantity(price, quantity);
+            if constexpr (has_level_updates<FillSink, LevelUpdate>::value) {
+                fill_sink.on_level_update(LevelUpdate{price, quantity, is_bid});
+            }
         }
 
-        inline void append(Order *order) {
-            quantity += order->quantity;
-            orders.append(order);
+        inline Levels* _get_side(bool is_bid) {
+            // Return pointer to the bid or ask tree based on whether an order is a bid or ask
+            return (is_bid) ? &bids : &asks;
         }
 
-        inline Order* pop_left() {
-            quantity -= get_head()->quantity;
-            return orders.pop_left();
+        inline std::pmr::map<StopKey, StopOrder>* _get_stops(const bool is_bid) {
+            return (is_bid) ? &bid_stops : &ask_stops;
         }
 
-        inline void remove(Order* order) {
-            quantity -= order->quantity;
-            orders.remove(order);
+        static inline StopKey _stop_key(const bool is_bid, const Price stop_price, const Id id) {
+            return {(is_bid) ? stop_price : Price(-stop_price), id};
         }
 
-        inline Order* get_head() {
-            return orders.head;
+        inline StopOrder& _find_stop(const Id id, const Location &location) {
+            return _get_stops(location.is_bid)->find(_stop_key(location.is_bid, location.price, id))->second;
         }
 
-        inline Order* get_tail() {
-            return orders.tail;
+        // Whether a value read from a batch or an image is representable in this book's types
+        template <typename T>
+        static inline bool _fits(const int64_t value) {
+            return value >= int64_t(std::numeric_limits<T>::min()) && value <= int64_t(std::numeric_limits<T>::max());
         }
 
-        inline int get_length() {
-            return orders.length;
+        // Whether an order left with quantity after matching joins the book
+        static inline bool _rests(const OrderType order_type) {
+            return order_type == OrderType::limit || order_type == OrderType::post_only || order_type == OrderType::post_only_slide;
         }
-};
 
-class LimitOrderBook final {
-    private:
-        std::map<int, LimitLevel*> bids;
-        std::map<int, LimitLevel*> asks;
-        std::unordered_map<int, Order*> orders;
-        
-        int order_id = 0;
+        inline Level* _create_level(const Price price) {
+            if (spare_levels.empty()) {
+                return level_pool.create(price, &block_pool, &node_resource);
+            }
+            Level *level = spare_levels.back();
+            spare_levels.pop_back();
+            level->price = price;
+            return level;
+        }
 
-        inline std::map<int, LimitLevel*>* _get_side(bool is_bid) {
-            // Return pointer to the bid or ask tree based on whether an order is a bid or ask
-            return (is_bid) ? &bids : &asks;
+        // Squeezes dead orders out of a level's queue once they fill half of it
+        inline void _compact(Level *level) {
+            if (level->orders.needs_compaction()) {
+                level->orders.compact([this](const Id id, const uint32_t position) {
+                    orders.find(id)->position = position;
+                });
+            }
         }
 
-        inline void _add_order(Order *order) {
-            std::map<int, LimitLevel*> *order_tree = _get_side(order->is_bid);
-            LimitLevel *best_ask = get_best_ask();
-            LimitLevel *best_bid = get_best_bid();
-
-            if (order->is_bid && best_ask != nullptr && best_ask->price <= order->price) {
-                _match_orders(order, best_ask);
-                return;
-            } else if (!order->is_bid && best_bid != nullptr && best_bid->price >= order->price) {
-                _match_orders(order, best_bid);
-                return;
-            }
-
-            if (order != nullptr) {
-                if (order->quantity > 0 && order->order_type != OrderType::fill_and_kill) {
-                    orders.insert(std::make_pair(order->id, order));
-                    
-                    // Insert order id to trader's orders made
-                    if (order_tree->count(order->price)) {
-                        order_tree->at(order->price)->append(order);
-                    } else {
-                        order_tree->insert(std::make_pair(order->price, new LimitLevel(order)));
-                    }
-                } else {
-                    // If order has zero quantity left or is fill and kill, delete it
-                    delete order;
+        // Removes an emptied level from its side. Orders can only be left behind if updates took the level's
+        // quantity to zero or below, their index entries go with it so they can't alias a later level at the price
+        inline void _destroy_level(const bool is_bid, Level *level) {
+            if (level->get_length() > 0) {
+                level->orders.for_each([this](const Order &order) {
+                    orders.erase(order.id);
+                });
+            }
+            _get_side(is_bid)->erase(level->price);
+            level->reset(0);
+            spare_levels.push_back(level);
+        }
+
+        // Sweeps the opposite side from its best level for as long as the order crosses, then rests what is left
+        // Each emptied level is erased before the next best is read, so the loop runs in constant stack depth
+        inline void _add_order(Order &order, const bool is_bid, const Price price) {
+            Levels *opposite = _get_side(!is_bid);
+
+            for (Level *level = opposite->best(); level != nullptr && order.quantity > 0; level = opposite->best()) {
+                if ((is_bid) ? level->price > price : level->price < price) {
+                    break;
                 }
+                _match_level(order, !is_bid, level);
             }
 
+            // Orders with no quantity left, immediate or cancel orders and unfilled market orders don't rest
+            if (order.quantity > 0 && _rests(order.order_type)) {
+                Levels *order_tree = _get_side(is_bid);
+                Level *level = order_tree->find(price);
+                if (level == nullptr) {
+                    level = _create_level(price);
+                    order_tree->insert(price, level);
+                }
+                orders.insert(order.id, {price, level->append(order), order.trader_id, is_bid, false});
+                _level_changed(is_bid, price, level->quantity);
+            }
         }
 
-        void _match_orders(Order *order, LimitLevel *best_value) {
-            if (best_value == nullptr) {
-                return;
-            }
+        // Fills order against one level in time priority. The level is destroyed unless it still holds quantity
+        // once the order is done, so a sweep always moves on to a new best level
+        inline void _match_level(Order &order, const bool level_is_bid, Level *level) {
+            const Price level_price = level->price;
 
-            while (best_value->quantity > 0 && order->quantity > 0 && best_value->get_length() > 0) {
-                // The value of the head of the LimitLevel's linked list
-                Order* head_order = best_value->get_head();
+            while (order.quantity > 0 && level->quantity > 0 && level->get_length() > 0) {
+                // The oldest order resting at the level
+                Order &head_order = level->orders.front();
 
-                if (order->quantity <= head_order->quantity) {
-                    executed_transactions.push_back({order->trader_id, head_order->trader_id, order->quantity, head_order->price});
-                    // Decrementing quantities
-                    head_order->quantity -= order->quantity;
-                    best_value->quantity -= order->quantity;
-                    order->quantity = 0;
-                } else {
-                    executed_transactions.push_back({order->trader_id, head_order->trader_id, head_order->quantity, head_order->price});
-                    // Decrementing quantities
-                    order->quantity -= head_order->quantity;
-                    best_value->quantity -= head_order->quantity;
-                    head_order->quantity = 0;
+                if (self_trade_prevention != SelfTradePrevention::none && head_order.trader_id == order.trader_id) {
+                    if (self_trade_prevention != SelfTradePrevention::cancel_oldest) {
+                        order.quantity = 0;
+                    }
+                    if (self_trade_prevention != SelfTradePrevention::cancel_newest) {
+                        level->quantity -= head_order.quantity;
+                        orders.erase(head_order.id);
+                        level->orders.pop_front();
+                    }
+                    continue;
                 }
 
-                if (order->quantity == 0 && orders.count(order->id)) {
-                    cancel(order->id, order->trader_id);
+                const Quantity filled = (order.quantity < head_order.quantity) ? order.quantity : head_order.quantity;
+
+                // Orders updated to a negative quantity can't trade, they are dropped without a fill
+                if (filled > 0) {
+                    fill_sink.on_fill(Transaction{order.trader_id, head_order.trader_id, level_price, filled, order.id, head_order.id});
+                    order.quantity -= filled;
+                    last_price = level_price;
                 }
-                
-                if (head_order->quantity == 0) {
-                    orders.erase(head_order->id);
-                    delete best_value->pop_left();  // Deletes head order as it is popped
+                head_order.quantity -= filled;
+                level->quantity -= filled;
+
+                if (head_order.quantity == 0) {
+                    orders.erase(head_order.id);
+                    level->orders.pop_front();
                 }
+            }
 
-                if (best_value->quantity == 0) {    
-                    std::map<int, LimitLevel*> *order_tree = _get_side(!(order->is_bid));
-                    if (order_tree->count(best_value->price)) {
-                        order_tree->erase(best_value->price);
+            // One update per level swept, however many orders it took
+            if (level->quantity > 0 && level->get_length() > 0) {
+                _level_changed(level_is_bid, level_price, level->quantity);
+                _compact(level);
+            } else {
+                _destroy_level(level_is_bid, level);
+                _level_changed(level_is_bid, level_price, 0);
+            }
+        }
+
+        // Opposite quantity an order could take at price or better, counting stops once it reaches quantity
+        // Under self trade prevention the trader's own resting orders never fill it. cancel_oldest cancels
+        // them and matching carries on, the other modes end the order at the first one, so the levels are
+        // walked order by order in time priority, only when the trader has something open
+        inline int64_t _available(const bool is_bid, const Price price, const Quantity quantity, const int trader_id) const {
+            const Levels &opposite = (is_bid) ? asks : bids;
+            if (self_trade_prevention == SelfTradePrevention::none || orders.trader_size(trader_id) == 0) {
+                Price reached;
+                return opposite.accumulate(price, quantity, reached);
+            }
+
+            const bool skips_own = (self_trade_prevention == SelfTradePrevention::cancel_oldest);
+            int64_t total = 0;
+            opposite.for_each_from_best([&](const Price level_price, const Level *level) {
+                if ((is_bid) ? level_price > price : level_price < price) {
+                    return false;
+                }
+                return level->orders.for_each_while([&](const Order &order) {
+                    if (order.trader_id == trader_id) {
+                        return skips_own;
                     }
+                    total += (order.quantity > 0) ? order.quantity : 0;
+                    return total < quantity;
+                });
+            });
+            return total;
+        }
+
+        // Keeps post only orders from taking liquidity, sliding price one tick behind the opposite best for
+        // post_only_slide. Returns false if the order must be rejected, other order types always pass
+        inline bool _passive_price(const bool is_bid, Price &price, const OrderType order_type) const {
+            if (order_type != OrderType::post_only && order_type != OrderType::post_only_slide) {
+                return true;
+            }
+
+            const Level *opposite = (is_bid ? asks : bids).best();
+            if (opposite != nullptr && ((is_bid) ? opposite->price <= price : opposite->price >= price)) {
+                // The opposite best is non-negative so only a bid can slide below 0 and only an ask past the maximum
+                if (order_type == OrderType::post_only || ((is_bid) ? opposite->price == 0 : opposite->price == max_price)) {
+                    return false;
+                }
+                const Price slid = (is_bid) ? Price(opposite->price - 1) : Price(opposite->price + 1);
+                if (!bids.in_range(slid)) {
+                    return false;
                 }
+                price = slid;
+            }
+            return true;
+        }
+
+        // Runs the pre-trade check of order types which have one, then matches the order. Orders failing their
+        // check are rejected with -1 before taking an id, limit and immediate or cancel orders go straight through
+        inline Id _enter(const bool is_bid, const Quantity quantity, Price price, const OrderType order_type, const int trader_id, const Price stop_price) {
+            if (quantity <= 0) {
+                return -1;
+            }
+            // Stop orders trade at market once triggered, so their price is not checked and rests as 0
+            if (order_type == OrderType::stop) {
+                price = 0;
+            } else if (price < 0 || !bids.in_range(price)) {
+                return -1;
             }
 
-            if (order != nullptr && order->quantity > 0) {
-                _add_order(order);
+            switch (order_type) {
+                case OrderType::post_only:
+                case OrderType::post_only_slide:
+                    if (!_passive_price(is_bid, price, order_type)) {
+                        return -1;
+                    }
+                    break;
+                case OrderType::fill_or_kill:
+                    if (_available(is_bid, price, quantity, trader_id) < quantity) {
+                        return -1;
+                    }
+                    break;
+                case OrderType::stop:
+                case OrderType::stop_limit:
+                    if (stop_price < 0 || !bids.in_range(stop_price)) {
+                        return -1;
+                    }
+                    return _add_stop(is_bid, quantity, price, order_type, trader_id, stop_price);
+                default:
+                    break;
             }
+
+            Order order{quantity, order_id, trader_id, order_type};
+            order_id++;
+
+            _add_order(order, is_bid, price);
+            _trigger_stops();
+            return order.id;
         }
 
-    public:
-        std::vector<Transaction> executed_transactions;
+        inline Id _add_stop(const bool is_bid, const Quantity quantity, const Price price, const OrderType order_type, const int trader_id, const Price stop_price) {
+            const StopOrder stop{{quantity, order_id, trader_id, order_type}, price};
+            order_id++;
 
-        LimitOrderBook() {}
+            _get_stops(is_bid)->emplace(_stop_key(is_bid, stop_price, stop.order.id), stop);
+            orders.insert(stop.order.id, {stop_price, 0, trader_id, is_bid, true});
 
-        inline LimitLevel* get_best_ask() {
-            if (!asks.empty()) {
-                return asks.begin()->second;
+            // A stop already through the last trade price goes straight in
+            _trigger_stops();
+            return stop.order.id;
+        }
+
+        // Takes a resting order out of its level and the index, destroying the level once it has no quantity left
+        // Returns a copy of the order
+        inline Order _remove(const Id id, const bool is_bid, Level *level, const uint32_t position) {
+            const Order order = level->orders.at(position);
+            level->quantity -= order.quantity;
+            level->orders.remove(position);
+            orders.erase(id);
+            _level_changed(is_bid, level->price, (level->quantity > 0) ? level->quantity : 0);
+
+            if (level->quantity <= 0) {
+                _destroy_level(is_bid, level);
             } else {
-                return nullptr;
+                _compact(level);
             }
+            return order;
         }
 
-        inline LimitLevel* get_best_bid() {
-            if (!bids.empty()) {
-                return bids.rbegin()->second;
-            } else {
-                return nullptr;
+        // Books without pending stops only pay for the two empty checks
+        inline void _trigger_stops() {
+            if (!bid_stops.empty() || !ask_stops.empty()) {
+                _run_stops();
             }
         }
 
-        inline void cancel(int id, const int trader_id) {
-            if (orders.count(id) && orders.at(id)->trader_id == trader_id) {
-                Order* current_order = orders.at(id);
-                std::map<int, LimitLevel*> *order_tree = _get_side(current_order->is_bid);
-                
-                if (order_tree->count(current_order->price)) {
-                    LimitLevel *price_level = order_tree->at(current_order->price);
-                    price_level->remove(current_order);
+        // Enters triggered stops one at a time, the lower id first when both sides have one ready
+        // Their fills move the last price and can set off further stops, which the same loop picks up
+        void _run_stops() {
+            while (last_price >= 0) {
+                const auto bid_it = bid_stops.begin();
+                const auto ask_it = ask_stops.begin();
+                const bool bid_ready = bid_it != bid_stops.end() && bid_it->first.first <= last_price;
+                const bool ask_ready = ask_it != ask_stops.end() && ask_it->first.first <= -last_price;
+                if (!bid_ready && !ask_ready) {
+                    return;
+                }
 
-                    if (price_level->quantity <= 0) {
-                        // Delete mapping for LimitLevel from order tree
-                        order_tree->erase(price_level->price);
-                        // Delete the LimitLevel memory from the order tree
-                        delete price_level;
-                    }
+                const bool is_bid = bid_ready && (!ask_ready || bid_it->first.second < ask_it->first.second);
+                StopOrder stop = (is_bid) ? bid_it->second : ask_it->second;
+                _get_stops(is_bid)->erase((is_bid) ? bid_it : ask_it);
+                orders.erase(stop.order.id);
+
+                if (stop.order.order_type == OrderType::stop) {
+                    stop.order.order_type = OrderType::market;
+                    stop.price = (is_bid) ? max_price : 0;
+                } else {
+                    stop.order.order_type = OrderType::limit;
                 }
+                _add_order(stop.order, is_bid, stop.price);
+            }
+        }
+
+    public:
+        // Any trailing arguments construct the fill sink
+        template <typename... FillSinkArgs>
+        explicit BasicLimitOrderBook(size_t order_capacity = 0, size_t level_capacity = 0, const typename Levels::Config &levels_config = {}, FillSinkArgs&&... fill_sink_args)
+            : fill_sink(std::forward<FillSinkArgs>(fill_sink_args)...),
+              block_pool(order_capacity / Block::size),
+              level_pool(level_capacity),
+              bids(true, levels_config, &node_resource),
+              asks(false, levels_config, &node_resource),
+              orders(order_capacity),
+              bid_stops(&node_resource),
+              ask_stops(&node_resource) {}
+
+        BasicLimitOrderBook(const BasicLimitOrderBook&) = delete;
+        BasicLimitOrderBook& operator=(const BasicLimitOrderBook&) = delete;
+
+        inline void reserve(size_t order_capacity, size_t level_capacity) {
+            // Pre-allocate pools so the first order_capacity resting orders never hit the heap
+            block_pool.reserve(order_capacity / Block::size);
+            level_pool.reserve(level_capacity);
+            orders.reserve(order_capacity);
+        }
+
+        inline Level* get_best_ask() {
+            return asks.best();
+        }
+
+        inline Level* get_best_bid() {
+            return bids.best();
+        }
 
-                delete current_order;
+        // Returns false if the order isn't open or belongs to another trader
+        inline bool cancel(Id id, const int trader_id) {
+            Location *location = orders.find(id);
+            if (location == nullptr || location->trader_id != trader_id) {
+                return false;
+            }
+
+            if (location->is_stop) {
+                _get_stops(location->is_bid)->erase(_stop_key(location->is_bid, location->price, id));
                 orders.erase(id);
+                return true;
             }
-        }
 
-        inline int bid(int quantity, const int price, const OrderType order_type, const int trader_id) {
-            if (price >= 0 && quantity > 0) {
-                Order *order = new Order(true, quantity, price, order_id, order_type, trader_id);
-                int _oid = order_id;  // Save order id from order
-                order_id++;
+            Level *price_level = _get_side(location->is_bid)->find(location->price);
+            if (price_level == nullptr) {
+                return false;
+            }
+            _remove(id, location->is_bid, price_level, location->position);
+            return true;
+        }
 
-                _add_order(order);
-                return _oid;  // Dont return order->id in case it has been deleted
-            } else {
-                return -1;  // Returns -1 if invalid order
+        // Cancels every open order of a trader, pending stops included, in O(k) for k orders
+        // Returns the number of orders cancelled
+        inline size_t cancel_all(const int trader_id) {
+            const size_t open = orders.trader_size(trader_id);
+            for (Id id = orders.trader_front(trader_id); id >= 0; id = orders.trader_front(trader_id)) {
+                cancel(id, trader_id);
             }
+            return open;
+        }
+
+        // Resting orders and pending stops of a trader
+        inline size_t get_open_orders(const int trader_id) const {
+            return orders.trader_size(trader_id);
+        }
+
+        inline void set_self_trade_prevention(const SelfTradePrevention mode) {
+            self_trade_prevention = mode;
         }
 
-        inline int market_bid(int quantity, const int trader_id) {
+        inline SelfTradePrevention get_self_trade_prevention() const {
+            return self_trade_prevention;
+        }
+
+        // Returns the order id, or -1 if the order is invalid or fails the pre-trade check of its type
+        // stop_price is only read by stop and stop limit orders, stop orders ignore price
+        inline Id bid(Quantity quantity, const Price price, const OrderType order_type, const int trader_id, const Price stop_price = -1) {
+            return _enter(true, quantity, price, order_type, trader_id, stop_price);
+        }
+
+        inline Id market_bid(Quantity quantity, const int trader_id) {
             if (quantity > 0) {
-                Order *order = new Order(true, quantity, INT32_MAX, order_id, OrderType::market, trader_id);
-                int _oid = order_id;
+                Order order{quantity, order_id, trader_id, OrderType::market};
                 order_id++;
 
-                _add_order(order);
-                return _oid;
+                _add_order(order, true, max_price);
+                _trigger_stops();
+                return order.id;
             } else {
                 return -1;
             }
         }
 
-        inline int ask(int quantity, const int price, const OrderType order_type, const int trader_id) {
-            if (price >= 0 && quantity > 0) {
-                Order *order = new Order(false, quantity, price, order_id, order_type, trader_id);
-                int _oid = order_id;  // Save order id from order
+        inline Id ask(Quantity quantity, const Price price, const OrderType order_type, const int trader_id, const Price stop_price = -1) {
+            return _enter(false, quantity, price, order_type, trader_id, stop_price);
+        }
+
+        inline Id market_ask(Quantity quantity, const int trader_id) {
+            if (quantity > 0) {
+                Order order{quantity, order_id, trader_id, OrderType::market};
                 order_id++;
 
-                _add_order(order);
-                return _oid;  // Dont return order->id in case it has been deleted
+                _add_order(order, false, 0);
+                _trigger_stops();
+                return order.id;
             } else {
-                return -1;  // Returns -1 if invalid order
+                return -1;
             }
         }
 
-        inline int market_ask(int quantity, const int trader_id) {
+        // Writes the price and aggregate quantity of up to n levels from the best price outwards
+        // Returns the number of levels written
+        inline size_t depth(const bool is_bid, const size_t n, Price *prices, Quantity *quantities) const {
+            return (is_bid ? bids : asks).depth(n, prices, quantities);
+        }
+
+        // Total quantity resting on one side at price or better, at or above price for bids and at or below for asks
+        inline int64_t quantity_through(const bool is_bid, const Price price) const {
+            Price reached;
+            return (is_bid ? bids : asks).accumulate(price, INT64_MAX, reached);
+        }
+
+        // Price of the level on one side at which the quantity resting from the best price reaches quantity,
+        // the worst price a market order of that size against the side would trade at. -1 if the side is too thin
+        inline Price price_for_quantity(const bool is_bid, const int64_t quantity) const {
+            Price reached = -1;
             if (quantity > 0) {
-                Order *order = new Order(false, quantity, 0, order_id, OrderType::market, trader_id);
-                int _oid = order_id;
-                order_id++;
+                (is_bid ? bids : asks).accumulate((is_bid) ? Price(0) : max_price, quantity, reached);
+            }
+            return reached;
+        }
 
-                _add_order(order);
-                return _oid;
-            } else {
+        // Routes a batched order to bid, ask, market_bid or market_ask, returns the order id or -1
+        inline Id submit(const OrderRequest &request) {
+            if (request.order_type > static_cast<uint8_t>(OrderType::stop_limit) || request.side > 1) {
                 return -1;
             }
+            if (!_fits<Quantity>(request.quantity) || !_fits<Price>(request.price) || !_fits<Price>(request.stop_price)) {
+                return -1;
+            }
+
+            const OrderType order_type = static_cast<OrderType>(request.order_type);
+            const bool is_bid = (request.side == 0);
+
+            if (order_type == OrderType::market) {
+                return (is_bid) ? market_bid(request.quantity, request.trader_id) : market_ask(request.quantity, request.trader_id);
+            }
+            return _enter(is_bid, request.quantity, request.price, order_type, request.trader_id, request.stop_price);
         }
 
-        inline void update(int id, int quantity, const int trader_id) {
+        // Applies count orders in sequence, ids[i] receives the id assigned to requests[i]
+        inline void submit_batch(const OrderRequest *requests, const size_t count, Id *ids) {
+            for (size_t i = 0; i < count; i++) {
+                ids[i] = submit(requests[i]);
+            }
+        }
+
+        inline void cancel_batch(const Id *ids, const int *trader_ids, const size_t count) {
+            for (size_t i = 0; i < count; i++) {
+                cancel(ids[i], trader_ids[i]);
+            }
+        }
+
+        // Returns false if the order isn't open or belongs to another trader
+        inline bool update(Id id, Quantity quantity, const int trader_id) {
             if (quantity == 0) {
                 // Cancel function checks by itself whether order id works
-                cancel(id, trader_id);
-            } else if (orders.count(id) && orders.at(id)->trader_id == trader_id) {
-                LimitLevel* level = nullptr;
-                Order* to_update = orders.at(id);
-                std::map<int, LimitLevel*> *order_tree = _get_side(to_update->is_bid);
+                return cancel(id, trader_id);
+            }
 
-                if (order_tree->count(to_update->price)) {
-                    level = order_tree->at(to_update->price);
-                } else {
-                    return;
+            Location *location = orders.find(id);
+            if (location == nullptr || location->trader_id != trader_id) {
+                return false;
+            }
+
+            // Pending stops have no queue priority to lose
+            if (location->is_stop) {
+                _find_stop(id, *location).order.quantity = quantity;
+                return true;
+            }
+
+            Level* level = _get_side(location->is_bid)->find(location->price);
+            if (level == nullptr) {
+                return false;
+            }
+
+            Order &to_update = level->orders.at(location->position);
+
+            Quantity quantity_difference = to_update.quantity - quantity;
+
+            if (quantity_difference >= 0) {
+                // If quantity is being decreased maintain order in price-time priority
+                to_update.quantity = quantity;
+                level->quantity -= quantity_difference;
+            } else {
+                // If quantity being increased move the order to the back of the queue
+                Order moved = to_update;
+                level->quantity -= moved.quantity;
+                level->orders.remove(location->position);
+
+                moved.quantity = quantity;
+                location->position = level->append(moved);
+                _compact(level);
+            }
+            // Updates may take an order, and so its level, below zero. Market data never reports that
+            _level_changed(location->is_bid, level->price, (level->quantity > 0) ? level->quantity : 0);
+            return true;
+        }
+
+        // Moves a resting order to a new price and quantity in one step, keeping its id and order type
+        // An order staying at its price without growing keeps its queue priority as with update, otherwise it
+        // leaves its level and joins the back of the new one, first matching if the new price crosses. Post only
+        // orders are checked again. Returns the id, or -1 with the order untouched if it isn't resting, belongs
+        // to another trader, is a pending stop or would take liquidity as a post only order
+        inline Id replace(const Id id, Price price, const Quantity quantity, const int trader_id) {
+            Location *location = orders.find(id);
+            if (location == nullptr || location->trader_id != trader_id || location->is_stop) {
+                return -1;
+            }
+            if (price < 0 || quantity <= 0 || !bids.in_range(price)) {
+                return -1;
+            }
+
+            const bool is_bid = location->is_bid;
+            Level *level = _get_side(is_bid)->find(location->price);
+            if (level == nullptr) {
+                return -1;
+            }
+
+            const Order &current = level->orders.at(location->position);
+            if (!_passive_price(is_bid, price, current.order_type)) {
+                return -1;
+            }
+            if (price == location->price && quantity <= current.quantity) {
+                update(id, quantity, trader_id);
+                return id;
+            }
+
+            Order order = _remove(id, is_bid, level, location->position);
+            order.quantity = quantity;
+            _add_order(order, is_bid, price);
+            _trigger_stops();
+            return id;
+        }
+
+        // Id the next accepted order will receive
+        inline Id get_next_order_id() const {
+            return order_id;
+        }
+
+        inline typename Levels::Config get_levels_config() const {
+            return bids.get_config();
+        }
+
+        // Appends an image of every resting order, pending stop and the id counter to image, see snapshot.hpp for the layout
+        // Fills still held by the fill sink are not part of the image
+        inline void snapshot(std::vector<unsigned char> &image, const uint64_t sequence = 0) const {
+            std::vector<SnapshotLevel> levels;
+            std::vector<SnapshotOrder> records;
+            records.reserve(orders.size());
+
+            auto collect = [&levels, &records](const Price price, const Level *level) {
+                levels.push_back({price, uint32_t(level->get_length()), 0});
+                level->orders.for_each([&records](const Order &order) {
+                    records.push_back({order.id, order.quantity, order.trader_id, static_cast<uint8_t>(order.order_type), {}});
+                });
+            };
+            bids.for_each(collect);
+            const size_t bid_levels = levels.size();
+            asks.for_each(collect);
+
+            std::vector<SnapshotStop> stops;
+            for (const bool is_bid : {true, false}) {
+                for (auto const& [key, stop] : (is_bid) ? bid_stops : ask_stops) {
+                    const int64_t stop_price = (is_bid) ? key.first : -int64_t(key.first);
+                    stops.push_back({stop.order.id, stop.order.quantity, stop_price, stop.price, stop.order.trader_id, static_cast<uint8_t>(stop.order.order_type), is_bid, {}});
                 }
+            }
 
-                int quantity_difference = to_update->quantity - quantity;
+            SnapshotHeader header{};
+            std::memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+            header.version = snapshot_version;
+            header.last_price = last_price;
+            header.sequence = sequence;
+            header.next_order_id = order_id;
+            header.bid_levels = bid_levels;
+            header.ask_levels = levels.size() - bid_levels;
+            header.orders = records.size();
+            header.stop_orders = stops.size();
+
+            const size_t offset = image.size();
+            image.resize(offset + sizeof(header) + levels.size() * sizeof(SnapshotLevel) + records.size() * sizeof(SnapshotOrder) + stops.size() * sizeof(SnapshotStop));
+            unsigned char *out = image.data() + offset;
+            std::memcpy(out, &header, sizeof(header));
+            out += sizeof(header);
+
+            // Empty sections are skipped, their data() may be null
+            auto append = [&out](const auto &section) {
+                if (!section.empty()) {
+                    std::memcpy(out, section.data(), section.size() * sizeof(section[0]));
+                    out += section.size() * sizeof(section[0]);
+                }
+            };
+            append(levels);
+            append(records);
+            append(stops);
+        }
 
-                if (quantity_difference >= 0) {
-                    // If quantity is being decreased maintain order in price-time priority
-                    to_update->quantity = quantity;
-                    level->quantity -= quantity_difference;
-                } else {
-                    // If quantity being increased move the order to the back of the queue
-                    level->remove(to_update);
-                    
-                    to_update->quantity = quantity;
+        // Rebuilds the resting orders of an empty book from an image written by snapshot(), returns its sequence
+        // Pools are sized once up front, then every level is rebuilt in a single pass in its original time priority
+        inline uint64_t restore(const unsigned char *image, const size_t size) {
+            if (orders.size() != 0) {
+                throw std::logic_error("restore requires a book with no resting orders");
+            }
+
+            SnapshotHeader header;
+            if (size < sizeof(header)) {
+                throw std::invalid_argument("Snapshot is truncated");
+            }
+            std::memcpy(&header, image, sizeof(header));
+            if (std::memcmp(header.magic, snapshot_magic, sizeof(snapshot_magic)) != 0 || header.version != snapshot_version) {
+                throw std::invalid_argument("Not a snapshot of this version");
+            }
+
+            // Each count is checked against the bytes left before it is multiplied, so no count read from the
+            // image can overflow the size computation
+            size_t remaining = size - sizeof(header);
+            for (const auto &[count, record_size] : {std::pair<uint64_t, size_t>{header.bid_levels, sizeof(SnapshotLevel)}, {header.ask_levels, sizeof(SnapshotLevel)},
+                    {header.orders, sizeof(SnapshotOrder)}, {header.stop_orders, sizeof(SnapshotStop)}}) {
+                if (count > remaining / record_size) {
+                    throw std::invalid_argument("Snapshot size does not match its header");
+                }
+                remaining -= size_t(count) * record_size;
+            }
+            if (remaining != 0) {
+                throw std::invalid_argument("Snapshot size does not match its header");
+            }
+            const uint64_t level_count = header.bid_levels + header.ask_levels;
+
+            const SnapshotLevel *levels = reinterpret_cast<const SnapshotLevel*>(image + sizeof(header));
+            const SnapshotOrder *records = reinterpret_cast<const SnapshotOrder*>(levels + level_count);
+            const SnapshotStop *stops = reinterpret_cast<const SnapshotStop*>(records + header.orders);
+
+            // Check the whole image before touching the book so a bad image leaves it empty
+            uint64_t order_total = 0;
+            for (uint64_t i = 0; i < level_count; i++) {
+                const bool sorted = (i == 0 || i == header.bid_levels || levels[i - 1].price < levels[i].price);
+                if (!sorted || levels[i].order_count == 0 || levels[i].price < 0 || !_fits<Price>(levels[i].price) || !bids.in_range(Price(levels[i].price))) {
+                    throw std::invalid_argument("Snapshot levels are out of order or out of range");
+                }
+                order_total += levels[i].order_count;
+            }
+            // Levels are ascending, so the last bid level is the best bid and the first ask level the best ask
+            if (header.bid_levels > 0 && header.ask_levels > 0 && levels[header.bid_levels - 1].price >= levels[header.bid_levels].price) {
+                throw std::invalid_argument("Snapshot book is crossed");
+            }
+            if (order_total != header.orders || header.next_order_id < 0 || !_fits<Id>(header.next_order_id) || header.last_price < -1 || !_fits<Price>(header.last_price)) {
+                throw std::invalid_argument("Snapshot order counts are inconsistent");
+            }
+            for (uint64_t i = 0; i < header.orders; i++) {
+                if (records[i].quantity <= 0 || !_fits<Quantity>(records[i].quantity) || records[i].id < 0 || records[i].id >= header.next_order_id || records[i].order_type > static_cast<uint8_t>(OrderType::stop_limit) || !_rests(static_cast<OrderType>(records[i].order_type))) {
+                    throw std::invalid_argument("Snapshot contains an invalid order");
+                }
+            }
+            for (uint64_t i = 0; i < header.stop_orders; i++) {
+                const SnapshotStop &stop = stops[i];
+                const bool is_stop = stop.order_type == static_cast<uint8_t>(OrderType::stop) || stop.order_type == static_cast<uint8_t>(OrderType::stop_limit);
+                if (!is_stop || stop.quantity <= 0 || !_fits<Quantity>(stop.quantity) || stop.id < 0 || stop.id >= header.next_order_id || stop.is_bid > 1
+                    || stop.stop_price < 0 || !_fits<Price>(stop.stop_price) || !bids.in_range(Price(stop.stop_price))
+                    || stop.price < 0 || !_fits<Price>(stop.price) || !bids.in_range(Price(stop.price))) {
+                    throw std::invalid_argument("Snapshot contains an invalid stop order");
+                }
+            }
+
+            // Ids are bounded by the image size, not by next_order_id, so duplicates are found by sorting
+            std::vector<int64_t> ids;
+            ids.reserve(header.orders + header.stop_orders);
+            for (uint64_t i = 0; i < header.orders; i++) {
+                ids.push_back(records[i].id);
+            }
+            for (uint64_t i = 0; i < header.stop_orders; i++) {
+                ids.push_back(stops[i].id);
+            }
+            std::sort(ids.begin(), ids.end());
+            if (std::adjacent_find(ids.begin(), ids.end()) != ids.end()) {
+                throw std::invalid_argument("Snapshot contains an order id twice");
+            }
+
+            block_pool.reserve(header.orders / Block::size + level_count);
+            level_pool.reserve(level_count);
 
-                    level->append(to_update);
+            const SnapshotOrder *record = records;
+            for (uint64_t i = 0; i < level_count; i++) {
+                const bool is_bid = (i < header.bid_levels);
+                const Price price = Price(levels[i].price);
+                Level *level = _create_level(price);
+
+                for (uint32_t j = 0; j < levels[i].order_count; j++, record++) {
+                    const Order order{Quantity(record->quantity), Id(record->id), record->trader_id, static_cast<OrderType>(record->order_type)};
+                    orders.insert(order.id, {price, level->append(order), order.trader_id, is_bid, false});
                 }
+                _get_side(is_bid)->insert(price, level);
+            }
+
+            for (uint64_t i = 0; i < header.stop_orders; i++) {
+                const SnapshotStop &stop = stops[i];
+                const Order order{Quantity(stop.quantity), Id(stop.id), stop.trader_id, static_cast<OrderType>(stop.order_type)};
+                _get_stops(stop.is_bid)->emplace(_stop_key(stop.is_bid, Price(stop.stop_price), order.id), StopOrder{order, Price(stop.price)});
+                orders.insert(order.id, {Price(stop.stop_price), 0, stop.trader_id, bool(stop.is_bid), true});
             }
+
+            order_id = Id(header.next_order_id);
+            last_price = Price(header.last_price);
+            return header.sequence;
+        }
+
+        inline FillSink& get_fill_sink() {
+            return fill_sink;
         }
 
+        inline const FillSink& get_fill_sink() const {
+            return fill_sink;
+        }
+
+        // Only available for sinks which buffer fills, such as VectorFillSink
         inline void clear_transactions() {
-            executed_transactions.clear();
+            fill_sink.clear();
         }
 
         std::string __repr__() {
             std::string res = "BIDS\n";
-            for (auto const& [key, val] : bids) {
+            bids.for_each([&res](const Price key, const Level *val) {
                 res += std::to_string(val->quantity) + " bids at price " + std::to_string(key) + "\n";
-            }
+            });
             res += "ASKS\n";
-            for (auto const& [key, val] : asks) {
+            asks.for_each([&res](const Price key, const Level *val) {
                 res += std::to_string(val->quantity) + " asks at price " + std::to_string(key) + "\n";
-            }
+            });
             return res;
         }
 };
 
+// Tree backed book accepting any non-negative price
+using LimitOrderBook = BasicLimitOrderBook<MapPriceLevels>;
+// Array backed book for instruments trading in a bounded tick band, see LadderPriceLevels::Config
+using LadderLimitOrderBook = BasicLimitOrderBook<LadderPriceLevels>;
+// Array backed book with 16 bit ticks, for dense simulations over at most 32768 prices
+using CompactLimitOrderBook = BasicLimitOrderBook<LadderPriceLevels, BasicVectorFillSink<CompactBookTypes>, CompactBookTypes>;
+// Tree backed book with 64 bit prices, quantities and ids, for venues and replays past the range of int
+using WideLimitOrderBook = BasicLimitOrderBook<MapPriceLevels, BasicVectorFillSink<WideBookTypes>, WideBookTypes>;
+
 #endif
\ No newline at end of file
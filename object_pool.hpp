@@ -0,0 +1,86 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Slab allocator with an intrusive free list
+// Objects are carved out of slabs which are never returned to the heap while the pool lives,
+// destroyed objects are threaded onto the free list and handed straight back out by create()
+template <typename T>
+class ObjectPool final {
+    private:
+        union Slot {
+            Slot *next_free;
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        std::vector<std::unique_ptr<Slot[]>> slabs;
+        Slot *free_list = nullptr;
+        size_t capacity = 0;
+        size_t in_use = 0;
+
+        void _grow(size_t count) {
+            Slot *slab = new Slot[count];
+
+            // Thread the new slab onto the front of the free list
+            for (size_t i = 0; i + 1 < count; i++) {
+                slab[i].next_free = &slab[i + 1];
+            }
+            slab[count - 1].next_free = free_list;
+            free_list = slab;
+
+            slabs.emplace_back(slab);
+            capacity += count;
+        }
+
+    public:
+        static constexpr size_t min_slab_size = 1024;
+
+        explicit ObjectPool(size_t initial_capacity = 0) {
+            reserve(initial_capacity);
+        }
+
+        ObjectPool(const ObjectPool&) = delete;
+        ObjectPool& operator=(const ObjectPool&) = delete;
+
+        inline void reserve(size_t count) {
+            if (count > capacity) {
+                _grow(count - capacity);
+            }
+        }
+
+        template <typename... Args>
+        inline T* create(Args&&... args) {
+            if (free_list == nullptr) {
+                // Double the pool each time so the number of slabs stays logarithmic
+                _grow((capacity > min_slab_size) ? capacity : min_slab_size);
+            }
+
+            Slot *slot = free_list;
+            free_list = slot->next_free;
+            in_use++;
+            return new (slot->storage) T(std::forward<Args>(args)...);
+        }
+
+        inline void destroy(T *object) {
+            object->~T();
+            Slot *slot = reinterpret_cast<Slot*>(object);
+            slot->next_free = free_list;
+            free_list = slot;
+            in_use--;
+        }
+
+        inline size_t size() const {
+            return in_use;
+        }
+
+        inline size_t get_capacity() const {
+            return capacity;
+        }
+};
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef ORDER_INDEX_H
+#define ORDER_INDEX_H
+
+#include "book_types.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Where a resting order sits, the price and side of its level and its position in the level's OrderQueue
+// Pending stop orders are indexed too, by their stop price with no position
+template <typename Types>
+struct OrderLocation {
+    typename Types::price_type price;  // -1 for ids with no resting order
+    uint32_t position;
+    int trader_id;
+    bool is_bid;
+    bool is_stop;
+    // Neighbours in the trader's list of open orders, -1 at either end, maintained by OrderIndex
+    // Kept in the location so an order and its links share a cache line
+    typename Types::id_type trader_prev = -1;
+    typename Types::id_type trader_next = -1;
+};
+
+// Direct indexed table from order id to the location of its resting order
+// Ids are handed out sequentially, so the id is split into a page number and an offset and every
+// lookup, insert and erase is a single indexed access with no hashing or probing. Consecutive ids
+// share a contiguous page, and a page whose orders have all left the book is recycled for newer ids.
+// The directory of pages only spans from the page of the oldest resting order to the newest, so it
+// costs one pointer per 4096 ids in that window rather than one per 4096 ids ever issued
+//
+// Each trader's open orders are also threaded into a list in arrival order through their locations,
+// so a trader's orders can be counted in O(1) and visited in O(k) without scanning the index
+template <typename Types>
+class OrderIndex final {
+    private:
+        using Id = typename Types::id_type;
+        using Location = OrderLocation<Types>;
+
+        static constexpr int page_bits = 12;
+        static constexpr size_t page_size = size_t(1) << page_bits;
+        static constexpr size_t page_mask = page_size - 1;
+
+        struct Page {
+            Location orders[page_size];
+            size_t live = 0;
+
+            Page() {
+                for (Location &location : orders) {
+                    location.price = -1;
+                }
+            }
+        };
+
+        struct TraderOrders {
+            Id head = -1;
+            Id tail = -1;
+            size_t count = 0;
+        };
+
+        // Trader ids are dense indexes in simulations and session ids in the server, so they are looked up
+        // directly like order ids. Ids outside [0, max_dense_trader) fall back to a hash map
+        static constexpr int max_dense_trader = 1 << 20;
+
+        std::vector<Page*> directory;  // Indexed by (id >> page_bits) - base, nullptr when no live orders
+        size_t base = 0;  // Page number of directory[0]
+        std::vector<Page*> free_pages;
+        std::vector<std::unique_ptr<Page>> allocated;
+        std::vector<TraderOrders> traders;  // Indexed by trader id
+        std::unordered_map<int, TraderOrders> sparse_traders;
+        size_t count = 0;
+
+        static inline size_t _page_of(const Id id) {
+            return size_t(static_cast<typename std::make_unsigned<Id>::type>(id) >> page_bits);
+        }
+
+        inline Location& _slot(const Id id) const {
+            return directory[_page_of(id) - base]->orders[id & page_mask];
+        }
+
+        // Drops the empty pages in front of the oldest live page once they make up half the directory, so
+        // the window slides forward in amortised O(1) per page as old orders leave the book
+        inline void _trim_front() {
+            size_t empty = 0;
+            while (empty < directory.size() && directory[empty] == nullptr) {
+                empty++;
+            }
+            if (empty == directory.size()) {
+                directory.clear();
+            } else if (2 * empty >= directory.size()) {
+                directory.erase(directory.begin(), directory.begin() + empty);
+                base += empty;
+            }
+        }
+
+        static inline bool _is_dense(const int trader_id) {
+            return trader_id >= 0 && trader_id < max_dense_trader;
+        }
+
+        inline TraderOrders& _trader(const int trader_id) {
+            if (_is_dense(trader_id)) {
+                if (size_t(trader_id) >= traders.size()) {
+                    traders.resize(size_t(trader_id) + 1);
+                }
+                return traders[trader_id];
+            }
+            return sparse_traders[trader_id];
+        }
+
+        inline const TraderOrders* _find_trader(const int trader_id) const {
+            if (_is_dense(trader_id)) {
+                return (size_t(trader_id) < traders.size()) ? &traders[trader_id] : nullptr;
+            }
+            auto it = sparse_traders.find(trader_id);
+            return (it != sparse_traders.end()) ? &it->second : nullptr;
+        }
+
+        inline Page* _take_page() {
+            if (free_pages.empty()) {
+                allocated.emplace_back(new Page());
+                return allocated.back().get();
+            }
+            Page *page = free_pages.back();
+            free_pages.pop_back();
+            return page;
+        }
+
+    public:
+        explicit OrderIndex(size_t capacity = 0) {
+            reserve(capacity);
+        }
+
+        OrderIndex(const OrderIndex&) = delete;
+        OrderIndex& operator=(const OrderIndex&) = delete;
+
+        // Pre-allocates enough pages for capacity consecutive ids
+        inline void reserve(size_t capacity) {
+            const size_t pages = (capacity + page_size - 1) / page_size;
+            while (allocated.size() < pages) {
+                allocated.emplace_back(new Page());
+                free_pages.push_back(allocated.back().get());
+            }
+        }
+
+        inline size_t size() const {
+            return count;
+        }
+
+        inline size_t trader_size(const int trader_id) const {
+            const TraderOrders *trader = _find_trader(trader_id);
+            return (trader != nullptr) ? trader->count : 0;
+        }
+
+        // Id of the trader's oldest open order, -1 when they have none
+        inline Id trader_front(const int trader_id) const {
+            const TraderOrders *trader = _find_trader(trader_id);
+            return (trader != nullptr) ? trader->head : -1;
+        }
+
+        // nullptr when the order is not resting, the location may be updated in place
+        inline Location* find(const Id id) const {
+            // Pages before base wrap round to a large index
+            const size_t page_index = _page_of(id) - base;
+            if (page_index >= directory.size() || directory[page_index] == nullptr) {
+                return nullptr;
+            }
+            Location *location = &directory[page_index]->orders[id & page_mask];
+            return (location->price >= 0) ? location : nullptr;
+        }
+
+        // Ids are unique so no check is made for an existing entry
+        inline void insert(const Id id, const Location &location) {
+            const size_t page_number = _page_of(id);
+            if (directory.empty()) {
+                base = page_number;
+            } else if (page_number < base) {
+                // Only restore and triggered stops reinsert old ids, so growing at the front is rare
+                directory.insert(directory.begin(), base - page_number, nullptr);
+                base = page_number;
+            }
+            const size_t page_index = page_number - base;
+            if (page_index >= directory.size()) {
+                directory.resize(page_index + 1, nullptr);
+            }
+
+            Page *&page = directory[page_index];
+            if (page == nullptr) {
+                page = _take_page();
+            }
+
+            Location &slot = page->orders[id & page_mask];
+            slot = location;
+            page->live++;
+            count++;
+
+            TraderOrders &trader = _trader(location.trader_id);
+            slot.trader_prev = trader.tail;
+            slot.trader_next = -1;
+            if (trader.tail >= 0) {
+                _slot(trader.tail).trader_next = id;
+            } else {
+                trader.head = id;
+            }
+            trader.tail = id;
+            trader.count++;
+        }
+
+        // The id must be present, callers look the order up first
+        inline void erase(const Id id) {
+            const size_t page_index = _page_of(id) - base;
+            Page *&page = directory[page_index];
+            Location &location = page->orders[id & page_mask];
+
+            // The trader was created by insert, so dense ids index straight in
+            const bool dense = _is_dense(location.trader_id);
+            TraderOrders &trader = (dense) ? traders[location.trader_id] : sparse_traders.find(location.trader_id)->second;
+            if (location.trader_prev >= 0) {
+                _slot(location.trader_prev).trader_next = location.trader_next;
+            } else {
+                trader.head = location.trader_next;
+            }
+            if (location.trader_next >= 0) {
+                _slot(location.trader_next).trader_prev = location.trader_prev;
+            } else {
+                trader.tail = location.trader_prev;
+            }
+            if (--trader.count == 0 && !dense) {
+                sparse_traders.erase(location.trader_id);
+            }
+
+            location.price = -1;
+            count--;
+
+            // Every slot of an empty page is already marked empty so it can be handed straight back out
+            if (--page->live == 0) {
+                free_pages.push_back(page);
+                page = nullptr;
+                if (page_index == 0) {
+                    _trim_front();
+                }
+            }
+        }
+};
+
+#endif
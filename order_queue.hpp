@@ -0,0 +1,219 @@
+#ifndef ORDER_QUEUE_H
+#define ORDER_QUEUE_H
+
+#include "book_types.hpp"
+#include "object_pool.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+// Values are part of the wire, journal and snapshot formats, new types are only ever appended
+enum class OrderType : uint8_t {
+    limit,
+    fill_and_kill,        // Same as immediate_or_cancel
+    market,
+    immediate_or_cancel,  // Fills what it can on arrival, the rest is dropped
+    post_only,            // Rejected if it would take liquidity
+    fill_or_kill,         // Fills in full on arrival or is rejected without touching the book
+    post_only_slide,      // Repriced one tick behind the opposite best if it would take liquidity
+    stop,                 // Waits for a trade at or through its stop price, then enters as a market order
+    stop_limit            // Waits like stop, then enters as a limit order at its price
+};
+
+// One order, stored by value in its level's queue. Price and side belong to the level
+// Widest fields first, so 32 bit books pack an order into 16 bytes and 64 bit books into 24
+template <typename Types>
+struct BasicOrder final {
+    typename Types::quantity_type quantity;
+    typename Types::id_type id;  // -1 once the order has left its queue
+    int trader_id;
+    OrderType order_type;
+};
+
+using Order = BasicOrder<DefaultBookTypes>;
+
+static_assert(sizeof(Order) == 16, "Order should pack into 16 bytes, four to a cache line");
+
+// Orders are stored in fixed size blocks shared by every level of a book through an ObjectPool
+template <typename Order>
+struct OrderBlock {
+    static constexpr uint32_t bits = 4;
+    static constexpr uint32_t size = uint32_t(1) << bits;
+    static constexpr uint32_t mask = size - 1;
+
+    Order orders[size];
+};
+
+// Time priority queue of the orders resting at one price
+//
+// Orders sit contiguously in arrival order, 16 to a block, so matching walks arrays rather than chasing a
+// pointer per order, and a queue grows a block at a time without ever copying its orders. Orders are
+// addressed by a 32 bit position which stays valid while they rest: blocks drained from the front go back
+// to the pool and base moves past them. Orders leaving from the middle are only marked dead, compact()
+// squeezes them out once they take up half the queue and reports the new position of each order it moves
+template <typename Order>
+class OrderQueue final {
+    private:
+        using Block = OrderBlock<Order>;
+
+        ObjectPool<Block> *pool;
+        std::pmr::vector<Block*> blocks;  // blocks[i] holds positions base + i * Block::size onwards
+        uint32_t first_block = 0;  // Blocks before this have been returned to the pool
+        uint32_t base = 0;
+        uint32_t head = 0;    // Position of the first order which may be live
+        uint32_t end = 0;     // Position the next order will take
+        uint32_t length = 0;  // Live orders
+
+        inline Order& _slot(const uint32_t position) {
+            const uint32_t offset = position - base;
+            return blocks[offset >> Block::bits]->orders[offset & Block::mask];
+        }
+
+        inline const Order& _slot(const uint32_t position) const {
+            const uint32_t offset = position - base;
+            return blocks[offset >> Block::bits]->orders[offset & Block::mask];
+        }
+
+        // Returns blocks which hold nothing at or after head
+        inline void _release_front() {
+            while (first_block < blocks.size() && (first_block + 1) * Block::size <= head - base) {
+                pool->destroy(blocks[first_block]);
+                blocks[first_block++] = nullptr;
+            }
+
+            // The block table is shifted down once half of it is released, so the shift costs O(1) per block
+            if (first_block > 0 && first_block * 2 >= blocks.size()) {
+                blocks.erase(blocks.begin(), blocks.begin() + first_block);
+                base += first_block * Block::size;
+                first_block = 0;
+            }
+        }
+
+    public:
+        OrderQueue(ObjectPool<Block> *_pool, std::pmr::memory_resource *resource) : pool(_pool), blocks(resource) {}
+
+        OrderQueue(const OrderQueue&) = delete;
+        OrderQueue& operator=(const OrderQueue&) = delete;
+
+        ~OrderQueue() {
+            for (size_t i = first_block; i < blocks.size(); i++) {
+                pool->destroy(blocks[i]);
+            }
+        }
+
+        // Empties the queue for reuse. One block is kept, so reusing the queue for a level that only ever
+        // holds a few orders never touches the pool
+        inline void clear() {
+            if (first_block < blocks.size()) {
+                for (size_t i = first_block + 1; i < blocks.size(); i++) {
+                    pool->destroy(blocks[i]);
+                }
+                blocks[0] = blocks[first_block];
+                blocks.resize(1);
+            }
+            first_block = 0;
+            base = head = end = length = 0;
+        }
+
+        inline uint32_t size() const {
+            return length;
+        }
+
+        // Returns the order's position
+        inline uint32_t push_back(const Order &order) {
+            if (((end - base) >> Block::bits) == blocks.size()) {
+                blocks.push_back(pool->create());
+            }
+            _slot(end) = order;
+            length++;
+            return end++;
+        }
+
+        inline Order& at(const uint32_t position) {
+            return _slot(position);
+        }
+
+        // Oldest live order, the queue must not be empty
+        inline Order& front() {
+            while (_slot(head).id < 0) {
+                head++;
+            }
+            return _slot(head);
+        }
+
+        // Removes the order returned by front()
+        inline void pop_front() {
+            _slot(head).id = -1;
+            head++;
+            length--;
+            if (((head - base) & Block::mask) == 0) {
+                _release_front();
+            }
+        }
+
+        inline void remove(const uint32_t position) {
+            _slot(position).id = -1;
+            length--;
+        }
+
+        inline bool needs_compaction() const {
+            const uint32_t span = end - head;
+            return span >= 4 * Block::size && (span - length) * 2 >= span;
+        }
+
+        // Drops every dead order, calls moved(id, position) for each live order whose position changes.
+        // Orders are slid towards the front in place, then blocks left empty at either end are returned
+        template <typename Moved>
+        inline void compact(Moved moved) {
+            while (head != end && _slot(head).id < 0) {
+                head++;
+            }
+
+            uint32_t write = head;
+            for (uint32_t read = head; read != end; read++) {
+                const Order &order = _slot(read);
+                if (order.id < 0) {
+                    continue;
+                }
+                if (read != write) {
+                    moved(order.id, write);
+                    _slot(write) = order;
+                }
+                write++;
+            }
+            end = write;
+
+            const size_t used_blocks = ((end - base) + Block::mask) >> Block::bits;
+            while (blocks.size() > used_blocks && blocks.size() > first_block) {
+                pool->destroy(blocks.back());
+                blocks.pop_back();
+            }
+            _release_front();
+        }
+
+        // Visits live orders in time priority
+        template <typename Visitor>
+        inline void for_each(Visitor visit) const {
+            for (uint32_t position = head; position != end; position++) {
+                const Order &order = _slot(position);
+                if (order.id >= 0) {
+                    visit(order);
+                }
+            }
+        }
+
+        // Visits live orders in time priority until visit returns false, returns false if it stopped early
+        template <typename Visitor>
+        inline bool for_each_while(Visitor visit) const {
+            for (uint32_t position = head; position != end; position++) {
+                const Order &order = _slot(position);
+                if (order.id >= 0 && !visit(order)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "wire_protocol.hpp"
+
+// Command: c++ -O3 -Wall -std=c++17 parser_benchmark.cpp -o parser_benchmark
+
+// Decodes the same stream of commands from the text and binary wire formats into a ring of Events,
+// the way session::parse_text and session::parse_binary do for one websocket frame
+
+const size_t message_count = 1000000;
+const size_t ring_size = 8192;
+
+int main() {
+    std::mt19937 rng(1);
+    std::string text;
+    std::string binary;
+
+    for (size_t i = 0; i < message_count; i++) {
+        Event event{};
+        event.command = rng() % 4;
+        event.order_type = OrderType::limit;
+        event.field_one = 1 + rng() % 1000;
+        event.field_two = 1 + rng() % 100000;
+
+        const char commands[] = {'B', 'A', 'C', 'U'};
+        text += commands[event.command];
+        text += " " + std::to_string(event.field_one);
+        if (event.command != cancel_command) {
+            text += " " + std::to_string(event.field_two);
+        }
+        text += "\n";
+
+        binary.append(reinterpret_cast<const char*>(&event), wire_event_size);
+    }
+
+    std::vector<Event> ring(ring_size);
+    uint64_t checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    size_t sequence = 0;
+    for (const std::string &line : split(text, '\n')) {
+        Event &event = ring[sequence++ & (ring_size - 1)];
+        if (parse_command(line, event)) {
+            checksum += event.field_one;
+        }
+    }
+    const double text_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>(binary.data());
+    sequence = 0;
+    for (size_t offset = 0; offset < binary.size(); offset += wire_event_size) {
+        const unsigned char *message = bytes + offset;
+        if (valid_wire_event(message)) {
+            Event &event = ring[sequence++ & (ring_size - 1)];
+            decode_event(message, event);
+            checksum += event.field_one;
+        }
+    }
+    const double binary_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::printf("text:   %6.1f ns/message\n", text_seconds * 1e9 / message_count);
+    std::printf("binary: %6.1f ns/message\n", binary_seconds * 1e9 / message_count);
+    std::printf("checksum %llu\n", static_cast<unsigned long long>(checksum));
+    return 0;
+}
@@ -0,0 +1,418 @@
+#ifndef PRICE_LEVELS_H
+#define PRICE_LEVELS_H
+
+#include "level_kernels.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory_resource>
+#include <stdexcept>
+#include <vector>
+
+// Price containers for one side of a LimitOrderBook
+// Each container maps a price to the Level resting there and keeps track of the best price,
+// the highest price for bids and the lowest for asks. Prices are the Level's price_type
+//
+// The book reports every change to a level's aggregate quantity through set_quantity, so containers can
+// answer depth queries without visiting the levels. Quantities below zero, left by updates to a negative
+// quantity, count as nothing available
+
+// Price levels held in a red-black tree, accepts any price
+template <typename Level>
+class MapPriceLevels final {
+    private:
+        using Price = typename Level::price_type;
+        using Quantity = typename Level::quantity_type;
+
+        const bool is_bid;
+        std::pmr::map<Price, Level*> levels;
+
+    public:
+        struct Config {};
+
+        MapPriceLevels(const bool _is_bid, const Config&, std::pmr::memory_resource *resource)
+            : is_bid(_is_bid), levels(resource) {}
+
+        inline Config get_config() const {
+            return {};
+        }
+
+        inline bool in_range(const Price) const {
+            return true;
+        }
+
+        inline bool empty() const {
+            return levels.empty();
+        }
+
+        inline Level* find(const Price price) const {
+            auto it = levels.find(price);
+            return (it != levels.end()) ? it->second : nullptr;
+        }
+
+        inline void insert(const Price price, Level *level) {
+            levels.emplace(price, level);
+        }
+
+        inline void erase(const Price price) {
+            levels.erase(price);
+        }
+
+        inline Level* best() const {
+            if (levels.empty()) {
+                return nullptr;
+            }
+            return (is_bid) ? levels.rbegin()->second : levels.begin()->second;
+        }
+
+        // Quantities are read from the levels themselves
+        inline void set_quantity(const Price, const Quantity) {}
+
+        // Sums quantity from the best price through limit, stopping at the first level where the sum reaches target
+        // reached is set to that level's price and left alone if the sum never gets there
+        inline int64_t accumulate(const Price limit, const int64_t target, Price &reached) const {
+            int64_t total = 0;
+            for_each_from_best([&](const Price price, const Level *level) {
+                if ((is_bid) ? price < limit : price > limit) {
+                    return false;
+                }
+                total += (level->quantity > 0) ? level->quantity : 0;
+                if (total >= target) {
+                    reached = price;
+                    return false;
+                }
+                return true;
+            });
+            return total;
+        }
+
+        // Writes up to n levels from the best price outwards, returns the number written
+        inline size_t depth(const size_t n, Price *prices, Quantity *quantities) const {
+            size_t written = 0;
+            if (n == 0) {
+                return 0;
+            }
+            for_each_from_best([&](const Price price, const Level *level) {
+                prices[written] = price;
+                quantities[written] = (level->quantity > 0) ? level->quantity : 0;
+                return ++written < n;
+            });
+            return written;
+        }
+
+        // Visits (price, level) pairs in ascending price order
+        template <typename Visitor>
+        inline void for_each(Visitor visit) const {
+            for (auto const& [price, level] : levels) {
+                visit(price, level);
+            }
+        }
+
+        // Visits (price, level) pairs from the best price outwards until visit returns false
+        template <typename Visitor>
+        inline void for_each_from_best(Visitor visit) const {
+            if (is_bid) {
+                for (auto it = levels.rbegin(); it != levels.rend() && visit(it->first, it->second); ++it) {}
+            } else {
+                for (auto it = levels.begin(); it != levels.end() && visit(it->first, it->second); ++it) {}
+            }
+        }
+};
+
+// Bitset with a summary word for every 64 words below it
+// Finding the next or previous set bit touches one word per layer, so at most 3 words for 2^18 bits
+class HierarchicalBitset final {
+    private:
+        std::vector<std::vector<uint64_t>> layers;
+
+    public:
+        static constexpr int64_t npos = -1;
+
+        explicit HierarchicalBitset(size_t bits) {
+            do {
+                bits = (bits + 63) / 64;
+                layers.emplace_back(bits, 0);
+            } while (bits > 1);
+        }
+
+        inline bool test(const size_t index) const {
+            return (layers[0][index >> 6] >> (index & 63)) & 1;
+        }
+
+        // The 64 bits holding index, bit 0 is index & ~63
+        inline uint64_t word(const size_t index) const {
+            return layers[0][index >> 6];
+        }
+
+        inline void set(size_t index) {
+            for (auto &layer : layers) {
+                uint64_t &word = layer[index >> 6];
+                const bool was_empty = (word == 0);
+                word |= uint64_t(1) << (index & 63);
+
+                // Summary bits above a non-empty word are already set
+                if (!was_empty) {
+                    return;
+                }
+                index >>= 6;
+            }
+        }
+
+        inline void reset(size_t index) {
+            for (auto &layer : layers) {
+                uint64_t &word = layer[index >> 6];
+                word &= ~(uint64_t(1) << (index & 63));
+
+                // Only clear the summary bit once the whole word is empty
+                if (word != 0) {
+                    return;
+                }
+                index >>= 6;
+            }
+        }
+
+        // Smallest set index >= index, or npos
+        inline int64_t find_next(size_t index) const {
+            size_t layer = 0;
+
+            for (; layer < layers.size(); layer++) {
+                const size_t word_index = index >> 6;
+                if (word_index >= layers[layer].size()) {
+                    return npos;
+                }
+
+                const uint64_t word = layers[layer][word_index] & (~uint64_t(0) << (index & 63));
+                if (word != 0) {
+                    index = (word_index << 6) | __builtin_ctzll(word);
+                    break;
+                }
+                index = word_index + 1;
+            }
+
+            if (layer == layers.size()) {
+                return npos;
+            }
+
+            // Descend to the lowest set bit under the summary bit found
+            while (layer > 0) {
+                layer--;
+                index = (index << 6) | __builtin_ctzll(layers[layer][index]);
+            }
+            return index;
+        }
+
+        // Largest set index <= index, or npos
+        inline int64_t find_prev(size_t index) const {
+            size_t layer = 0;
+
+            for (; layer < layers.size(); layer++) {
+                const size_t word_index = index >> 6;
+                const uint64_t word = layers[layer][word_index] & (~uint64_t(0) >> (63 - (index & 63)));
+                if (word != 0) {
+                    index = (word_index << 6) | (63 - __builtin_clzll(word));
+                    break;
+                }
+                if (word_index == 0) {
+                    return npos;
+                }
+                index = word_index - 1;
+            }
+
+            if (layer == layers.size()) {
+                return npos;
+            }
+
+            // Descend to the highest set bit under the summary bit found
+            while (layer > 0) {
+                layer--;
+                index = (index << 6) | (63 - __builtin_clzll(layers[layer][index]));
+            }
+            return index;
+        }
+};
+
+// Price levels held in a contiguous array indexed by (price - min_price)
+// Prices outside [min_price, max_price] are rejected, insert, erase and best are O(1)
+//
+// Each level's quantity is mirrored into a second array of the same shape, so cumulative quantity queries
+// sum runs of adjacent prices with the kernels of level_kernels.hpp instead of visiting levels one by one.
+// Runs of 64 empty prices are skipped through the bitset, so sparse ladders cost no more than a level walk
+template <typename Level>
+class LadderPriceLevels final {
+    private:
+        using Price = typename Level::price_type;
+        using Quantity = typename Level::quantity_type;
+
+        const bool is_bid;
+        const Price min_price;
+        const Price max_price;
+        std::vector<Level*> levels;
+        std::vector<Quantity> quantities;  // 0 where no level rests
+        HierarchicalBitset occupied;
+        int64_t best_index = HierarchicalBitset::npos;
+
+    public:
+        struct Config {
+            Price min_price = 0;
+            Price max_price = (std::numeric_limits<Price>::max() < UINT16_MAX) ? std::numeric_limits<Price>::max() : Price(UINT16_MAX);
+        };
+
+        LadderPriceLevels(const bool _is_bid, const Config &config, std::pmr::memory_resource*)
+            : is_bid(_is_bid),
+              min_price(config.min_price),
+              max_price(config.max_price),
+              levels((config.max_price >= config.min_price) ? size_t(int64_t(config.max_price) - config.min_price + 1) : 0, nullptr),
+              quantities(levels.size(), 0),
+              occupied(levels.size()) {
+            if (levels.empty()) {
+                throw std::invalid_argument("LadderPriceLevels requires min_price <= max_price");
+            }
+        }
+
+        inline Config get_config() const {
+            return {min_price, max_price};
+        }
+
+        inline bool in_range(const Price price) const {
+            return price >= min_price && price <= max_price;
+        }
+
+        inline bool empty() const {
+            return best_index == HierarchicalBitset::npos;
+        }
+
+        inline Level* find(const Price price) const {
+            return levels[int64_t(price) - min_price];
+        }
+
+        inline void insert(const Price price, Level *level) {
+            const int64_t index = int64_t(price) - min_price;
+            levels[index] = level;
+            quantities[index] = (level->quantity > 0) ? level->quantity : 0;
+            occupied.set(index);
+
+            if (best_index == HierarchicalBitset::npos || (is_bid ? index > best_index : index < best_index)) {
+                best_index = index;
+            }
+        }
+
+        inline void erase(const Price price) {
+            const int64_t index = int64_t(price) - min_price;
+            levels[index] = nullptr;
+            quantities[index] = 0;
+            occupied.reset(index);
+
+            if (index == best_index) {
+                best_index = (is_bid) ? occupied.find_prev(index) : occupied.find_next(index);
+            }
+        }
+
+        inline Level* best() const {
+            return (best_index == HierarchicalBitset::npos) ? nullptr : levels[best_index];
+        }
+
+        inline void set_quantity(const Price price, const Quantity quantity) {
+            quantities[int64_t(price) - min_price] = (quantity > 0) ? quantity : 0;
+        }
+
+        // Sums quantity from the best price through limit, stopping at the first level where the sum reaches target
+        // reached is set to that level's price and left alone if the sum never gets there
+        // Whole runs of occupied words are summed at once, only the run the target falls in is walked price by price
+        inline int64_t accumulate(const Price limit, const int64_t target, Price &reached) const {
+            if (best_index == HierarchicalBitset::npos) {
+                return 0;
+            }
+            const int64_t last = std::clamp<int64_t>(int64_t(limit) - min_price, -1, int64_t(levels.size()));
+            int64_t total = 0;
+
+            if (is_bid) {
+                for (int64_t index = best_index; index != HierarchicalBitset::npos && index >= last;) {
+                    const int64_t start = std::max<int64_t>(index & ~int64_t(63), last);
+                    const int64_t run = sum_quantities(&quantities[start], size_t(index - start + 1));
+                    if (total + run >= target) {
+                        for (;; index--) {
+                            total += quantities[index];
+                            if (total >= target) {
+                                reached = Price(index + min_price);
+                                return total;
+                            }
+                        }
+                    }
+                    total += run;
+                    index = (start == 0) ? HierarchicalBitset::npos : occupied.find_prev(start - 1);
+                }
+            } else {
+                for (int64_t index = best_index; index != HierarchicalBitset::npos && index <= last;) {
+                    const int64_t end = std::min<int64_t>(index | 63, std::min<int64_t>(last, int64_t(levels.size()) - 1));
+                    const int64_t run = sum_quantities(&quantities[index], size_t(end - index + 1));
+                    if (total + run >= target) {
+                        for (;; index++) {
+                            total += quantities[index];
+                            if (total >= target) {
+                                reached = Price(index + min_price);
+                                return total;
+                            }
+                        }
+                    }
+                    total += run;
+                    index = occupied.find_next(end + 1);
+                }
+            }
+            return total;
+        }
+
+        // Writes up to n levels from the best price outwards, returns the number written
+        // Occupied prices are read a word of the bitset at a time, the levels themselves are never touched
+        inline size_t depth(const size_t n, Price *prices, Quantity *out_quantities) const {
+            size_t written = 0;
+            for (int64_t index = best_index; index != HierarchicalBitset::npos && written < n;) {
+                const int64_t base = index & ~int64_t(63);
+                uint64_t bits = occupied.word(index);
+                if (is_bid) {
+                    bits &= ~uint64_t(0) >> (63 - (index & 63));
+                    for (; bits != 0 && written < n; bits &= ~(uint64_t(1) << (63 - __builtin_clzll(bits)))) {
+                        const int64_t at = base + 63 - __builtin_clzll(bits);
+                        prices[written] = Price(at + min_price);
+                        out_quantities[written++] = quantities[at];
+                    }
+                    index = (base == 0) ? HierarchicalBitset::npos : occupied.find_prev(base - 1);
+                } else {
+                    bits &= ~uint64_t(0) << (index & 63);
+                    for (; bits != 0 && written < n; bits &= bits - 1) {
+                        const int64_t at = base + __builtin_ctzll(bits);
+                        prices[written] = Price(at + min_price);
+                        out_quantities[written++] = quantities[at];
+                    }
+                    index = occupied.find_next(base + 64);
+                }
+            }
+            return written;
+        }
+
+        // Visits (price, level) pairs in ascending price order
+        template <typename Visitor>
+        inline void for_each(Visitor visit) const {
+            for (int64_t index = occupied.find_next(0); index != HierarchicalBitset::npos; index = occupied.find_next(index + 1)) {
+                visit(Price(index + min_price), levels[index]);
+            }
+        }
+
+        // Visits (price, level) pairs from the best price outwards until visit returns false
+        template <typename Visitor>
+        inline void for_each_from_best(Visitor visit) const {
+            for (int64_t index = best_index; index != HierarchicalBitset::npos;) {
+                if (!visit(Price(index + min_price), levels[index])) {
+                    return;
+                }
+
+                if (is_bid) {
+                    index = (index == 0) ? HierarchicalBitset::npos : occupied.find_prev(index - 1);
+                } else {
+                    index = occupied.find_next(index + 1);
+                }
+            }
+        }
+};
+
+#endif
@@ -1,61 +1,286 @@
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #include <pybind11/operators.h>
+#include <stdexcept>
 #include <sstream>
 #include <string>
+#include <type_traits>
+#include "latency_stats.hpp"
 #include "limit_order_book.hpp"
+#include "trader.hpp"
 
 // Command: c++ -O3 -Wall -shared -std=c++17 -fPIC $(python3 -m pybind11 --includes)  pybindings.cpp -o BristolMatchingEngine$(python3-config --extension-suffix)
 
 namespace py = pybind11;
 
-PYBIND11_MODULE(BristolMatchingEngine, m) {
-    py::enum_<OrderType>(m, "OrderType")
-        .value("limit", OrderType::limit)
-        .value("fill_and_kill", OrderType::fill_and_kill)
-        .value("market", OrderType::market)
-        .export_values();
+// Set by enable_latency_stats, off so plain calls don't pay for the timestamps. Only read and written with the GIL held
+static bool time_book_calls = false;
 
-    py::class_<LimitOrderBook>(m, "LimitOrderBook")
-        .def(py::init<>())
-        .def("get_best_ask", &LimitOrderBook::get_best_ask)
-        .def("get_best_bid", &LimitOrderBook::get_best_bid)
+// Wraps a book method so each call is recorded in the "book" latency stage once enable_latency_stats() is called
+template <typename Book, typename Result, typename... Args>
+auto timed(Result (Book::*method)(Args...)) {
+    return [method](Book &lob, Args... args) -> Result {
+        if (!time_book_calls) {
+            return (lob.*method)(args...);
+        }
+        const uint64_t start = latency_ticks();
+        if constexpr (std::is_void<Result>::value) {
+            (lob.*method)(args...);
+            record_latency(LatencyStage::book, start);
+        } else {
+            Result result = (lob.*method)(args...);
+            record_latency(LatencyStage::book, start);
+            return result;
+        }
+    };
+}
+
+// Binds the shared LimitOrderBook API for each price container, constructors are added per book
+template <typename Book>
+py::class_<Book> bind_limit_order_book(py::module_ &m, const char *name) {
+    return py::class_<Book>(m, name)
+        .def("reserve", &Book::reserve, py::arg("order_capacity"), py::arg("level_capacity"))
+        .def("get_best_ask", &Book::get_best_ask)
+        .def("get_best_bid", &Book::get_best_bid)
         .def(
             "bid", 
-            &LimitOrderBook::bid, 
-            "Creates a bid (buy order) on the limit order book from the specified trader at specified quantity and price.\nReturns assigned order id.", 
+            timed(&Book::bid), 
+            "Creates a bid (buy order) on the limit order book from the specified trader at specified quantity and price.\nstop_price is only used by stop and stop_limit orders.\nReturns assigned order id, -1 for rejected orders.", 
             py::arg("quantity"),
             py::arg("price"),
             py::arg("order_type"),
-            py::arg("trader_id")
+            py::arg("trader_id"),
+            py::arg("stop_price") = -1
             )
         .def(
             "ask", 
-            &LimitOrderBook::ask,
-            "Creates an ask (sell order) on the limit order book from the specified trader at specified quantity and price.\nReturns assigned order id.", 
+            timed(&Book::ask),
+            "Creates an ask (sell order) on the limit order book from the specified trader at specified quantity and price.\nstop_price is only used by stop and stop_limit orders.\nReturns assigned order id, -1 for rejected orders.", 
             py::arg("quantity"),
             py::arg("price"),
             py::arg("order_type"),
-            py::arg("trader_id")
+            py::arg("trader_id"),
+            py::arg("stop_price") = -1
             )
         .def(
             "market_bid",
-            &LimitOrderBook::market_bid,
+            timed(&Book::market_bid),
             "Buys n quantity at the best prices available on the LimitOrderBook",
             py::arg("quantity"),
             py::arg("trader_id")
         )
         .def(
             "market_ask",
-            &LimitOrderBook::market_ask,
+            timed(&Book::market_ask),
             "Sells n quantity at the best prices available on the LimitOrderBook",
             py::arg("quantity"),
             py::arg("trader_id")
         )
-        .def("cancel", &LimitOrderBook::cancel)
-        .def("update", &LimitOrderBook::update)
-        .def("__repr__", &LimitOrderBook::__repr__)
-        .def("__str__", &LimitOrderBook::__repr__)
-        .def("get_executed_transactions", [](const LimitOrderBook &lob) { return lob.executed_transactions; });;
+        .def(
+            "submit_batch",
+            [](Book &lob, const py::array_t<OrderRequest, py::array::c_style | py::array::forcecast> &requests) {
+                py::array_t<int> ids(requests.size());
+                const OrderRequest *request_data = requests.data();
+                int *id_data = ids.mutable_data();
+                const size_t count = requests.size();
+
+                // The batch keeps the GIL: the book has no lock of its own, so holding the GIL is what stops another
+                // Python thread using it mid batch, and the batch already pays a single crossing for every order
+                lob.submit_batch(request_data, count, id_data);
+                return ids;
+            },
+            "Submits an array of order_request_dtype records (side, order_type, quantity, price, trader_id, stop_price) in one call.\nSide is 0 for bids and 1 for asks. Returns the assigned order ids, -1 for rejected orders.",
+            py::arg("orders")
+        )
+        .def(
+            "cancel_batch",
+            [](Book &lob, const py::array_t<int, py::array::c_style | py::array::forcecast> &ids, const py::array_t<int, py::array::c_style | py::array::forcecast> &trader_ids) {
+                if (ids.size() != trader_ids.size()) {
+                    throw std::invalid_argument("ids and trader_ids must have the same length");
+                }
+                const int *id_data = ids.data();
+                const int *trader_data = trader_ids.data();
+                const size_t count = ids.size();
+
+                // Holds the GIL for the same reason as submit_batch
+                lob.cancel_batch(id_data, trader_data, count);
+            },
+            "Cancels each order id on behalf of the matching trader id",
+            py::arg("ids"),
+            py::arg("trader_ids")
+        )
+        .def("cancel", timed(&Book::cancel))
+        .def("update", timed(&Book::update))
+        .def(
+            "replace",
+            timed(&Book::replace),
+            "Moves a resting order to a new price and quantity in one step, keeping its id.\nIt keeps its queue priority only if the price is unchanged and the quantity does not grow, and matches first if the new price crosses.\nReturns the order id, -1 if the order was left untouched.",
+            py::arg("id"),
+            py::arg("price"),
+            py::arg("quantity"),
+            py::arg("trader_id")
+        )
+        .def("cancel_all", timed(&Book::cancel_all), "Cancels every open order of a trader, returns the number cancelled", py::arg("trader_id"))
+        .def("get_open_orders", &Book::get_open_orders, "Number of resting orders and pending stops of a trader", py::arg("trader_id"))
+        .def_property("self_trade_prevention", &Book::get_self_trade_prevention, &Book::set_self_trade_prevention)
+        .def("__repr__", &Book::__repr__)
+        .def("__str__", &Book::__repr__)
+        .def("get_executed_transactions", [](const Book &lob) { return lob.get_fill_sink().transactions; })
+        .def("clear_transactions", &Book::clear_transactions)
+        .def(
+            "take_transactions",
+            [](Book &lob) {
+                // Hand the fill buffer itself to NumPy, the capsule frees it once the array is collected
+                auto *transactions = new std::vector<Transaction>(std::move(lob.get_fill_sink().transactions));
+                lob.get_fill_sink().transactions = std::vector<Transaction>();
+                py::capsule owner(transactions, [](void *ptr) { delete static_cast<std::vector<Transaction>*>(ptr); });
+
+                return py::array_t<Transaction>(
+                    {static_cast<py::ssize_t>(transactions->size())},
+                    {static_cast<py::ssize_t>(sizeof(Transaction))},
+                    transactions->data(),
+                    owner
+                );
+            },
+            "Moves all executed transactions out of the book without copying.\nReturns a structured array with fields taker, maker, price and quantity, the book's transaction list is left empty."
+        )
+        .def(
+            "depth",
+            [](const Book &lob, const size_t n) {
+                py::array_t<int> bid_prices(n), bid_quantities(n), ask_prices(n), ask_quantities(n);
+                const size_t bid_levels = lob.depth(true, n, bid_prices.mutable_data(), bid_quantities.mutable_data());
+                const size_t ask_levels = lob.depth(false, n, ask_prices.mutable_data(), ask_quantities.mutable_data());
+
+                bid_prices.resize({bid_levels});
+                bid_quantities.resize({bid_levels});
+                ask_prices.resize({ask_levels});
+                ask_quantities.resize({ask_levels});
+                return py::make_tuple(bid_prices, bid_quantities, ask_prices, ask_quantities);
+            },
+            "Returns (bid_prices, bid_quantities, ask_prices, ask_quantities) for up to n levels per side, best price first",
+            py::arg("n")
+        )
+        .def(
+            "quantity_through",
+            &Book::quantity_through,
+            "Total quantity resting on one side at price or better",
+            py::arg("is_bid"),
+            py::arg("price")
+        )
+        .def(
+            "price_for_quantity",
+            &Book::price_for_quantity,
+            "Price of the level on one side at which the quantity resting from the best price reaches quantity, -1 if the side is too thin.\nThe worst price a market order of that size against the side would trade at.",
+            py::arg("is_bid"),
+            py::arg("quantity")
+        )
+        .def(
+            "snapshot",
+            [](const Book &lob, const std::string &path, const uint64_t sequence) { save_snapshot(lob, path, sequence); },
+            "Writes every resting order and the order id counter to a binary image at path, tagged with sequence",
+            py::arg("path"),
+            py::arg("sequence") = 0
+        )
+        .def(
+            "restore",
+            [](Book &lob, const std::string &path) { return load_snapshot(lob, path); },
+            "Restores an image written by snapshot into this book, which must have no resting orders.\nReturns the image's sequence.",
+            py::arg("path")
+        )
+        .def(
+            "fork",
+            [](const Book &lob) {
+                std::vector<unsigned char> image;
+                lob.snapshot(image);
+
+                auto copy = std::make_unique<Book>(0, 0, lob.get_levels_config());
+                copy->restore(image.data(), image.size());
+                return copy;
+            },
+            "Returns an independent copy of the book's resting orders, e.g. to branch a simulation. Executed transactions are not copied."
+        )
+        .def(
+            "run_experiment",
+            [](Book &lob, const int start, const int end, std::vector<Trader> &traders, const uint64_t seed, const int min_price, const int max_price) {
+                // Holds the GIL like the batches, the run mutates both the book and the traders
+                return run_experiment(lob, start, end, traders, seed, min_price, max_price);
+            },
+            "Runs time steps [start, end) of an agent based market, each step gives len(traders) randomly chosen traders a turn.\nFills are added to the executed transactions, returns an ExperimentSummary.",
+            py::arg("start"),
+            py::arg("end"),
+            py::arg("traders"),
+            py::arg("seed") = 0,
+            py::arg("min_price") = 1,
+            py::arg("max_price") = 200
+        );
+}
+
+PYBIND11_MODULE(BristolMatchingEngine, m) {
+    PYBIND11_NUMPY_DTYPE(OrderRequest, side, order_type, quantity, price, trader_id, stop_price);
+    m.attr("order_request_dtype") = py::dtype::of<OrderRequest>();
+    PYBIND11_NUMPY_DTYPE_EX(Transaction, trader_one, "taker", trader_two, "maker", price, "price", quantity, "quantity", taker_order_id, "taker_order", maker_order_id, "maker_order");
+
+    m.def(
+        "latency_stats",
+        []() {
+            py::dict stats;
+            for (size_t stage = 0; stage < size_t(LatencyStage::count); stage++) {
+                const LatencySummary summary = LatencyStats::instance().summary(LatencyStage(stage));
+                py::dict values;
+                values["count"] = summary.count;
+                values["mean"] = summary.mean;
+                values["min"] = summary.min;
+                values["p50"] = summary.p50;
+                values["p90"] = summary.p90;
+                values["p99"] = summary.p99;
+                values["p99.9"] = summary.p999;
+                values["max"] = summary.max;
+                stats[latency_stage_names[stage]] = values;
+            }
+            return stats;
+        },
+        "Returns {stage: {count, mean, min, p50, p90, p99, p99.9, max}} in nanoseconds, merged over every thread.\nBook calls made from Python are recorded under \"book\" after enable_latency_stats(), all stages are empty when built with -DCPPLOB_LATENCY_STATS=0."
+    );
+    m.def(
+        "enable_latency_stats",
+        [](const bool enabled) { time_book_calls = enabled; },
+        "Starts or stops recording book calls made from Python under the \"book\" stage, they are untimed by default",
+        py::arg("enabled") = true
+    );
+    m.def("reset_latency_stats", []() { LatencyStats::instance().reset(); }, "Clears every latency histogram");
+
+    py::enum_<OrderType>(m, "OrderType")
+        .value("limit", OrderType::limit)
+        .value("fill_and_kill", OrderType::fill_and_kill)
+        .value("market", OrderType::market)
+        .value("immediate_or_cancel", OrderType::immediate_or_cancel)
+        .value("post_only", OrderType::post_only)
+        .value("fill_or_kill", OrderType::fill_or_kill)
+        .value("post_only_slide", OrderType::post_only_slide)
+        .value("stop", OrderType::stop)
+        .value("stop_limit", OrderType::stop_limit)
+        .export_values();
+
+    py::enum_<SelfTradePrevention>(m, "SelfTradePrevention")
+        .value("none", SelfTradePrevention::none)
+        .value("cancel_newest", SelfTradePrevention::cancel_newest)
+        .value("cancel_oldest", SelfTradePrevention::cancel_oldest)
+        .value("cancel_both", SelfTradePrevention::cancel_both);
+
+    bind_limit_order_book<LimitOrderBook>(m, "LimitOrderBook")
+        .def(py::init<size_t, size_t>(), py::arg("order_capacity") = 0, py::arg("level_capacity") = 0);
+
+    bind_limit_order_book<LadderLimitOrderBook>(m, "LadderLimitOrderBook")
+        .def(
+            py::init([](const int min_price, const int max_price, const size_t order_capacity, const size_t level_capacity) {
+                return new LadderLimitOrderBook(order_capacity, level_capacity, {min_price, max_price});
+            }),
+            "Book for prices in the tick band [min_price, max_price], stored in a flat array of levels",
+            py::arg("min_price"),
+            py::arg("max_price"),
+            py::arg("order_capacity") = 0,
+            py::arg("level_capacity") = 0
+        );
 
 
     py::class_<std::vector<Transaction>>(m, "TransactionVector")
@@ -89,12 +314,72 @@ PYBIND11_MODULE(BristolMatchingEngine, m) {
             }); 
 
     
+    py::enum_<Strategy>(m, "Strategy")
+        .value("zic", Strategy::zic)
+        .value("zip", Strategy::zip)
+        .value("shaver", Strategy::shaver)
+        .export_values();
+
+    py::class_<Trader>(m, "Trader")
+        .def(
+            py::init<const bool, const bool, const Strategy, const int, const int>(),
+            "A trading agent for run_experiment, limit_price=-1 draws a private value from the experiment's price band",
+            py::arg("is_buyer"),
+            py::arg("is_seller"),
+            py::arg("strategy") = Strategy::zic,
+            py::arg("limit_price") = Trader::random_limit_price,
+            py::arg("quantity") = 1
+        )
+        .def_readwrite("is_buyer", &Trader::is_buyer)
+        .def_readwrite("is_seller", &Trader::is_seller)
+        .def_readwrite("strategy", &Trader::strategy)
+        .def_readwrite("limit_price", &Trader::limit_price)
+        .def_readwrite("quantity", &Trader::quantity)
+        .def_readonly("trader_id", &Trader::trader_id)
+        .def_readonly("order_id", &Trader::order_id)
+        .def_readonly("margin", &Trader::margin)
+        .def_readonly("profit", &Trader::profit)
+        .def_readonly("traded_quantity", &Trader::traded_quantity);
+
+    py::class_<std::vector<Trader>>(m, "TraderVector")
+        .def(py::init<>())
+        .def("clear", &std::vector<Trader>::clear)
+        .def("pop", &std::vector<Trader>::pop_back)
+        .def("append", [](std::vector<Trader> &v, const Trader &trader) { v.push_back(trader); })
+        .def("__len__", [](const std::vector<Trader> &v) { return v.size(); })
+        .def("__iter__", [](std::vector<Trader> &v) {
+            return py::make_iterator(v.begin(), v.end());
+        }, py::keep_alive<0, 1>())
+        .def("__getitem__", [](const std::vector<Trader> &v, const int idx) { return (idx > -1) ? v.at(idx) : v.at(v.size() + idx); });
+
+    py::class_<ExperimentSummary>(m, "ExperimentSummary")
+        .def_readonly("steps", &ExperimentSummary::steps)
+        .def_readonly("orders_submitted", &ExperimentSummary::orders_submitted)
+        .def_readonly("fills", &ExperimentSummary::fills)
+        .def_readonly("volume", &ExperimentSummary::volume)
+        .def_readonly("vwap", &ExperimentSummary::vwap)
+        .def_readonly("min_trade_price", &ExperimentSummary::min_trade_price)
+        .def_readonly("max_trade_price", &ExperimentSummary::max_trade_price)
+        .def_readonly("last_trade_price", &ExperimentSummary::last_trade_price)
+        .def_readonly("total_profit", &ExperimentSummary::total_profit)
+        .def("__repr__", [](const ExperimentSummary &summary) {
+            std::stringstream ss;
+            ss << "ExperimentSummary(steps=" << summary.steps << ", orders_submitted=" << summary.orders_submitted << ", fills=" << summary.fills
+               << ", volume=" << summary.volume << ", vwap=" << summary.vwap << ", last_trade_price=" << summary.last_trade_price
+               << ", total_profit=" << summary.total_profit << ")";
+            return ss.str();
+        });
+
     py::class_<Transaction>(m, "Transaction")
-        .def(py::init<const int, const int, const int, const int>())
+        .def(py::init([](const int taker_id, const int maker_id, const int price, const int quantity, const int taker_order_id, const int maker_order_id) {
+            return Transaction{taker_id, maker_id, price, quantity, taker_order_id, maker_order_id};
+        }), py::arg("taker_id"), py::arg("maker_id"), py::arg("price"), py::arg("quantity"), py::arg("taker_order_id") = -1, py::arg("maker_order_id") = -1)
         .def_readonly("taker_id", &Transaction::trader_one)
         .def_readonly("maker_id", &Transaction::trader_two)
         .def_readonly("price", &Transaction::price)
         .def_readonly("quantity", &Transaction::quantity)
+        .def_readonly("taker_order_id", &Transaction::taker_order_id)
+        .def_readonly("maker_order_id", &Transaction::maker_order_id)
         .def("__repr__", &Transaction::to_str)
         .def("__str__", &Transaction::to_str);
 
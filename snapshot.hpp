@@ -0,0 +1,116 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Flat binary image of a book's resting state, written by BasicLimitOrderBook::snapshot
+//
+// [SnapshotHeader][SnapshotLevel x bid_levels][SnapshotLevel x ask_levels][SnapshotOrder x orders][SnapshotStop x stop_orders]
+// Levels are in ascending price order per side, and the orders of each level follow each other in time
+// priority, bid levels first, so restoring is one sequential pass with no lookups. Pending stops follow,
+// buy stops first, each side in the order it triggers. The version changes
+// whenever the layout does, images of another version are refused rather than misread
+
+constexpr char snapshot_magic[8] = {'C', 'P', 'P', 'L', 'O', 'B', 'S', 'N'};
+constexpr uint32_t snapshot_version = 3;
+
+// Prices, quantities and ids are stored 64 bits wide whatever the book's BookTypes, so an image taken from
+// one book can be restored into any book whose types can hold its values
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t sequence;       // Journal sequence the image was taken at, supplied by the caller
+    int64_t next_order_id;
+    int64_t last_price;      // Price of the last fill, -1 before the first, stops trigger against it
+    uint64_t bid_levels;
+    uint64_t ask_levels;
+    uint64_t orders;
+    uint64_t stop_orders;
+};
+
+struct SnapshotLevel {
+    int64_t price;
+    uint32_t order_count;
+    uint32_t padding;
+};
+
+struct SnapshotOrder {
+    int64_t id;
+    int64_t quantity;
+    int32_t trader_id;
+    uint8_t order_type;
+    uint8_t padding[3];
+};
+
+struct SnapshotStop {
+    int64_t id;
+    int64_t quantity;
+    int64_t stop_price;
+    int64_t price;
+    int32_t trader_id;
+    uint8_t order_type;
+    uint8_t is_bid;
+    uint8_t padding[2];
+};
+
+static_assert(sizeof(SnapshotHeader) == 72 && sizeof(SnapshotLevel) == 16 && sizeof(SnapshotOrder) == 24 && sizeof(SnapshotStop) == 40,
+    "Snapshot records must have no implicit padding");
+
+// Writes a book's image to path, replacing any existing file
+template <typename Book>
+void save_snapshot(const Book &book, const std::string &path, const uint64_t sequence = 0) {
+    std::vector<unsigned char> image;
+    book.snapshot(image, sequence);
+
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Could not open snapshot " + path);
+    }
+    const bool written = std::fwrite(image.data(), 1, image.size(), file) == image.size();
+    if (std::fclose(file) != 0 || !written) {
+        throw std::runtime_error("Could not write snapshot " + path);
+    }
+}
+
+// Maps the image at path and restores it into an empty book, returns the image's sequence
+template <typename Book>
+uint64_t load_snapshot(Book &book, const std::string &path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open snapshot " + path);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Could not read the size of snapshot " + path);
+    }
+    const size_t size = size_t(info.st_size);
+    void *address = (size > 0) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (address == MAP_FAILED) {
+        throw std::runtime_error("Could not map snapshot " + path);
+    }
+
+    madvise(address, size, MADV_SEQUENTIAL);
+    try {
+        const uint64_t sequence = book.restore(static_cast<const unsigned char*>(address), size);
+        munmap(address, size);
+        return sequence;
+    } catch (...) {
+        munmap(address, size);
+        throw;
+    }
+}
+
+#endif
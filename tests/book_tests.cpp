@@ -0,0 +1,155 @@
+// Checks of the matching rules and the market data they produce, run on both price containers
+// Build from the repository root:
+// c++ -O2 -Wall -std=c++17 tests/book_tests.cpp -o book_tests
+
+#include "../limit_order_book.hpp"
+#include "check.hpp"
+
+namespace {
+
+// Books which also keep level updates, so their market data can be checked
+using MapBook = BasicLimitOrderBook<MapPriceLevels, MarketDataSink>;
+using LadderBook = BasicLimitOrderBook<LadderPriceLevels, MarketDataSink>;
+
+template <typename Book>
+int64_t filled_quantity(Book &book) {
+    int64_t total = 0;
+    for (const auto &transaction : book.get_fill_sink().transactions)
+        total += transaction.quantity;
+    return total;
+}
+
+// Trader 1 rests 5 at 100, trader 2 rests foreign at 101 behind it, then trader 1 sends a fill or kill bid
+// for 10 through 101. Returns the bid's id, the fills are left in the sink
+template <typename Book>
+int fill_or_kill_against_own(Book &book, const SelfTradePrevention mode, const int foreign) {
+    book.set_self_trade_prevention(mode);
+    book.ask(5, 100, OrderType::limit, 1);
+    book.ask(foreign, 101, OrderType::limit, 2);
+    book.get_fill_sink().clear();
+    return book.bid(10, 101, OrderType::fill_or_kill, 1);
+}
+
+// Without prevention the trader's own order trades like any other
+template <typename Book>
+void test_fill_or_kill_without_prevention() {
+    Book book;
+    CHECK(fill_or_kill_against_own(book, SelfTradePrevention::none, 5) >= 0);
+    CHECK(filled_quantity(book) == 10);
+    CHECK(book.get_best_ask() == nullptr);
+}
+
+// cancel_oldest cancels the own order and carries on, so only foreign quantity counts
+template <typename Book>
+void test_fill_or_kill_cancel_oldest() {
+    {
+        Book book;
+        CHECK(fill_or_kill_against_own(book, SelfTradePrevention::cancel_oldest, 5) < 0);
+        CHECK(filled_quantity(book) == 0);
+        CHECK(book.get_best_ask() != nullptr && book.get_best_ask()->price == 100 && book.get_best_ask()->quantity == 5);
+        CHECK(book.get_open_orders(1) == 1);
+    }
+    {
+        Book book;
+        CHECK(fill_or_kill_against_own(book, SelfTradePrevention::cancel_oldest, 10) >= 0);
+        CHECK(filled_quantity(book) == 10);
+        CHECK(book.get_best_ask() == nullptr && book.get_open_orders(1) == 0);
+    }
+}
+
+// cancel_newest and cancel_both end the incoming order at its trader's first own order, whatever rests behind
+template <typename Book>
+void test_fill_or_kill_ending_at_own(const SelfTradePrevention mode) {
+    {
+        Book book;
+        CHECK(fill_or_kill_against_own(book, mode, 20) < 0);
+        CHECK(filled_quantity(book) == 0);
+        CHECK(book.get_best_ask() != nullptr && book.get_best_ask()->price == 100 && book.get_best_ask()->quantity == 5);
+        CHECK(book.get_open_orders(1) == 1 && book.get_open_orders(2) == 1);
+    }
+    {
+        // Enough foreign quantity ahead of the own order
+        Book book;
+        book.set_self_trade_prevention(mode);
+        book.ask(10, 100, OrderType::limit, 2);
+        book.ask(5, 100, OrderType::limit, 1);
+        CHECK(book.bid(10, 100, OrderType::fill_or_kill, 1) >= 0);
+        CHECK(filled_quantity(book) == 10);
+        CHECK(book.get_best_ask() != nullptr && book.get_best_ask()->quantity == 5 && book.get_open_orders(1) == 1);
+    }
+    {
+        // Foreign quantity behind the own order at the same price does not count
+        Book book;
+        book.set_self_trade_prevention(mode);
+        book.ask(5, 100, OrderType::limit, 2);
+        book.ask(5, 100, OrderType::limit, 1);
+        book.ask(5, 100, OrderType::limit, 2);
+        CHECK(book.bid(10, 100, OrderType::fill_or_kill, 1) < 0);
+        CHECK(filled_quantity(book) == 0 && book.get_best_ask()->quantity == 15);
+    }
+}
+
+// A negative update takes the level's total below zero, its level update still reports 0
+template <typename Book>
+void test_negative_update_reports_empty_level() {
+    Book book;
+    const int id = book.bid(5, 100, OrderType::limit, 1);
+    book.get_fill_sink().clear();
+
+    CHECK(book.update(id, -3, 1));
+    const auto &updates = book.get_fill_sink().level_updates;
+    CHECK(updates.size() == 1 && updates[0].price == 100 && updates[0].is_bid && updates[0].quantity == 0);
+}
+
+// Pages of ids are dropped from the front of the index as their orders leave, an order left behind on an
+// old page must stay reachable and the newest ids must keep landing after it
+template <typename Book>
+void test_old_order_outlives_index_window() {
+    Book book;
+    const int old_id = book.bid(5, 90, OrderType::limit, 1);
+    for (int i = 0; i < 3 * 4096; i++) {
+        book.cancel(book.ask(1, 200, OrderType::limit, 2), 2);
+    }
+    CHECK(book.get_open_orders(2) == 0);
+
+    const int new_id = book.bid(5, 91, OrderType::limit, 1);
+    CHECK(book.get_open_orders(1) == 2);
+    CHECK(book.update(old_id, 2, 1));
+    CHECK(book.cancel(new_id, 1) && book.cancel(old_id, 1));
+    CHECK(!book.cancel(old_id, 1) && book.get_best_bid() == nullptr);
+}
+
+// A plain stop trades at market once triggered, so its price is ignored even outside the book's range
+template <typename Book>
+void test_stop_ignores_price(const typename Book::Levels::Config &config) {
+    Book book(0, 0, config);
+    book.ask(5, 100, OrderType::limit, 2);
+    book.ask(5, 101, OrderType::limit, 2);
+
+    const int stop_id = book.bid(3, 0, OrderType::stop, 1, 100);
+    CHECK(stop_id >= 0 && book.get_open_orders(1) == 1);
+
+    book.bid(5, 100, OrderType::limit, 3);
+    CHECK(filled_quantity(book) == 8 && book.get_open_orders(1) == 0);
+    CHECK(book.get_best_ask() != nullptr && book.get_best_ask()->price == 101 && book.get_best_ask()->quantity == 2);
+}
+
+template <typename Book>
+void test_book() {
+    test_fill_or_kill_without_prevention<Book>();
+    test_fill_or_kill_cancel_oldest<Book>();
+    test_fill_or_kill_ending_at_own<Book>(SelfTradePrevention::cancel_newest);
+    test_fill_or_kill_ending_at_own<Book>(SelfTradePrevention::cancel_both);
+    test_negative_update_reports_empty_level<Book>();
+    test_old_order_outlives_index_window<Book>();
+}
+
+}
+
+int main() {
+    test_book<MapBook>();
+    test_book<LadderBook>();
+    test_stop_ignores_price<MapBook>({});
+    test_stop_ignores_price<LadderBook>({90, 110});
+    return report("book_tests");
+}
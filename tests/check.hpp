@@ -0,0 +1,31 @@
+#ifndef TESTS_CHECK_H
+#define TESTS_CHECK_H
+
+#include <cstdio>
+
+// Minimal assertions shared by the standalone test programs in tests/
+// A failed CHECK reports its line and carries on, main returns report() so a failing program exits non-zero
+
+inline int& check_failures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition)                                                                          \
+    do {                                                                                          \
+        if (!(condition)) {                                                                       \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);   \
+            check_failures()++;                                                                   \
+        }                                                                                         \
+    } while (0)
+
+inline int report(const char *name) {
+    if (check_failures() == 0) {
+        std::printf("%s: passed\n", name);
+        return 0;
+    }
+    std::printf("%s: %d checks failed\n", name, check_failures());
+    return 1;
+}
+
+#endif
@@ -0,0 +1,471 @@
+// Runs seeded random order flow through the book on both price containers and through a reference copy of
+// the matching engine from before the sweep was made iterative, and compares every fill, level update and
+// snapshot image. Ends with deep sweeps across thousands of levels, and one across a million on the books alone
+// Build from the repository root:
+// c++ -O2 -Wall -std=c++17 tests/differential_test.cpp -o differential_test
+
+#include "../limit_order_book.hpp"
+#include "check.hpp"
+#include <cstring>
+#include <deque>
+#include <map>
+#include <random>
+#include <unordered_map>
+
+namespace {
+
+// The matching engine as of the commit storing levels in OrderQueues, the last one to match recursively:
+// _add_order matches against the opposite best, and _match_orders takes one level in time priority, reports
+// it once and calls _add_order again with whatever is left. Levels are plain maps of deques so nothing is
+// shared with the code under test. Covers the order types that existed then, limit, fill_and_kill and market
+class ReferenceBook final {
+    private:
+        struct Order {
+            int quantity;
+            int trader_id;
+            int id;
+            OrderType order_type;
+        };
+
+        struct Level {
+            int quantity = 0;
+            std::deque<Order> orders;
+        };
+
+        struct Location {
+            bool is_bid;
+            int price;
+        };
+
+        std::map<int, Level> bids;
+        std::map<int, Level> asks;
+        std::unordered_map<int, Location> orders;
+        int order_id = 0;
+        int last_price = -1;
+
+        std::map<int, Level>& _get_side(const bool is_bid) {
+            return (is_bid) ? bids : asks;
+        }
+
+        std::deque<Order>::iterator _find(Level &level, const int id) {
+            for (auto it = level.orders.begin(); it != level.orders.end(); ++it) {
+                if (it->id == id)
+                    return it;
+            }
+            return level.orders.end();
+        }
+
+        void _add_order(Order &order, const bool is_bid, const int price) {
+            if (is_bid && !asks.empty() && asks.begin()->first <= price) {
+                _match_orders(order, is_bid, price, asks.begin()->first);
+                return;
+            } else if (!is_bid && !bids.empty() && bids.rbegin()->first >= price) {
+                _match_orders(order, is_bid, price, bids.rbegin()->first);
+                return;
+            }
+
+            if (order.quantity > 0 && order.order_type != OrderType::fill_and_kill && order.order_type != OrderType::market) {
+                Level &level = _get_side(is_bid)[price];
+                level.orders.push_back(order);
+                level.quantity += order.quantity;
+                orders[order.id] = {is_bid, price};
+                level_updates.push_back({price, level.quantity, is_bid});
+            }
+        }
+
+        void _match_orders(Order &order, const bool is_bid, const int price, const int level_price) {
+            std::map<int, Level> &side = _get_side(!is_bid);
+            Level &level = side[level_price];
+            bool destroyed = false;
+
+            while (level.quantity > 0 && order.quantity > 0 && !level.orders.empty()) {
+                Order &head_order = level.orders.front();
+                const int filled = std::min(order.quantity, head_order.quantity);
+                transactions.push_back({order.trader_id, head_order.trader_id, level_price, filled, order.id, head_order.id});
+                last_price = level_price;
+                head_order.quantity -= filled;
+                level.quantity -= filled;
+                order.quantity -= filled;
+
+                if (head_order.quantity == 0) {
+                    orders.erase(head_order.id);
+                    level.orders.pop_front();
+                }
+                if (level.quantity == 0) {
+                    for (const Order &left : level.orders)
+                        orders.erase(left.id);
+                    side.erase(level_price);
+                    destroyed = true;
+                    break;
+                }
+            }
+
+            level_updates.push_back({level_price, destroyed ? 0 : level.quantity, !is_bid});
+            if (order.quantity > 0) {
+                _add_order(order, is_bid, price);
+            }
+        }
+
+    public:
+        std::vector<Transaction> transactions;
+        std::vector<LevelUpdate> level_updates;
+
+        int bid(const int quantity, const int price, const OrderType order_type, const int trader_id) {
+            if (price < 0 || quantity <= 0)
+                return -1;
+            Order order{quantity, trader_id, order_id++, order_type};
+            _add_order(order, true, price);
+            return order.id;
+        }
+
+        int ask(const int quantity, const int price, const OrderType order_type, const int trader_id) {
+            if (price < 0 || quantity <= 0)
+                return -1;
+            Order order{quantity, trader_id, order_id++, order_type};
+            _add_order(order, false, price);
+            return order.id;
+        }
+
+        int market_bid(const int quantity, const int trader_id) {
+            if (quantity <= 0)
+                return -1;
+            Order order{quantity, trader_id, order_id++, OrderType::market};
+            _add_order(order, true, INT32_MAX);
+            return order.id;
+        }
+
+        int market_ask(const int quantity, const int trader_id) {
+            if (quantity <= 0)
+                return -1;
+            Order order{quantity, trader_id, order_id++, OrderType::market};
+            _add_order(order, false, 0);
+            return order.id;
+        }
+
+        void cancel(const int id, const int trader_id) {
+            const auto location = orders.find(id);
+            if (location == orders.end())
+                return;
+            const bool is_bid = location->second.is_bid;
+            const int price = location->second.price;
+            std::map<int, Level> &side = _get_side(is_bid);
+            Level &level = side[price];
+            const auto it = _find(level, id);
+            if (it->trader_id != trader_id)
+                return;
+
+            level.quantity -= it->quantity;
+            level.orders.erase(it);
+            orders.erase(id);
+            level_updates.push_back({price, std::max(level.quantity, 0), is_bid});
+            if (level.quantity <= 0) {
+                for (const Order &left : level.orders)
+                    orders.erase(left.id);
+                side.erase(price);
+            }
+        }
+
+        void update(const int id, const int quantity, const int trader_id) {
+            if (quantity == 0) {
+                cancel(id, trader_id);
+                return;
+            }
+            const auto location = orders.find(id);
+            if (location == orders.end())
+                return;
+            const bool is_bid = location->second.is_bid;
+            const int price = location->second.price;
+            Level &level = _get_side(is_bid)[price];
+            const auto it = _find(level, id);
+            if (it->trader_id != trader_id)
+                return;
+
+            const int difference = it->quantity - quantity;
+            if (difference >= 0) {
+                it->quantity = quantity;
+                level.quantity -= difference;
+            } else {
+                Order moved = *it;
+                level.quantity -= moved.quantity;
+                level.orders.erase(it);
+                moved.quantity = quantity;
+                level.orders.push_back(moved);
+                level.quantity += quantity;
+            }
+            level_updates.push_back({price, level.quantity, is_bid});
+        }
+
+        // Image laid out as snapshot.hpp describes, for comparing byte for byte with the books' own
+        std::vector<unsigned char> snapshot() const {
+            std::vector<SnapshotLevel> levels;
+            std::vector<SnapshotOrder> records;
+            for (const std::map<int, Level> *side : {&bids, &asks}) {
+                for (const auto &[price, level] : *side) {
+                    levels.push_back({price, uint32_t(level.orders.size()), 0});
+                    for (const Order &order : level.orders)
+                        records.push_back({order.id, order.quantity, order.trader_id, static_cast<uint8_t>(order.order_type), {}});
+                }
+            }
+
+            SnapshotHeader header{};
+            std::memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+            header.version = snapshot_version;
+            header.next_order_id = order_id;
+            header.last_price = last_price;
+            header.bid_levels = bids.size();
+            header.ask_levels = asks.size();
+            header.orders = records.size();
+
+            std::vector<unsigned char> image(sizeof(header) + levels.size() * sizeof(SnapshotLevel) + records.size() * sizeof(SnapshotOrder));
+            unsigned char *out = image.data();
+            std::memcpy(out, &header, sizeof(header));
+            out += sizeof(header);
+            if (!levels.empty()) {
+                std::memcpy(out, levels.data(), levels.size() * sizeof(SnapshotLevel));
+                out += levels.size() * sizeof(SnapshotLevel);
+            }
+            if (!records.empty()) {
+                std::memcpy(out, records.data(), records.size() * sizeof(SnapshotOrder));
+            }
+            return image;
+        }
+
+        void clear_sink() {
+            transactions.clear();
+            level_updates.clear();
+        }
+};
+
+using MapBook = BasicLimitOrderBook<MapPriceLevels, MarketDataSink>;
+using LadderBook = BasicLimitOrderBook<LadderPriceLevels, MarketDataSink>;
+
+bool same_fills(const std::vector<Transaction> &a, const std::vector<Transaction> &b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].trader_one != b[i].trader_one || a[i].trader_two != b[i].trader_two || a[i].price != b[i].price || a[i].quantity != b[i].quantity
+            || a[i].taker_order_id != b[i].taker_order_id || a[i].maker_order_id != b[i].maker_order_id)
+            return false;
+    }
+    return true;
+}
+
+bool same_level_updates(const std::vector<LevelUpdate> &a, const std::vector<LevelUpdate> &b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].price != b[i].price || a[i].quantity != b[i].quantity || a[i].is_bid != b[i].is_bid)
+            return false;
+    }
+    return true;
+}
+
+template <typename Book>
+std::vector<unsigned char> image_of(const Book &book) {
+    std::vector<unsigned char> image;
+    book.snapshot(image);
+    return image;
+}
+
+// One operation applied to the reference and to every book
+struct Operation {
+    enum Kind { limit, fill_and_kill, market, cancel, update } kind;
+    bool is_bid;
+    int quantity;
+    int price;
+    int trader_id;
+    int target;
+};
+
+// Prices stay in a narrow band around the middle so orders cross often and levels hold several orders
+class Flow final {
+    private:
+        std::mt19937 random;
+        std::vector<std::pair<int, int>> issued;  // (id, trader) of every accepted order, cancelled or not
+
+        int uniform(const int low, const int high) {
+            return std::uniform_int_distribution<int>(low, high)(random);
+        }
+
+    public:
+        explicit Flow(const uint32_t seed) : random(seed) {}
+
+        Operation next() {
+            const int roll = uniform(0, 99);
+            Operation operation{Operation::limit, uniform(0, 1) == 0, uniform(1, 100), 0, uniform(0, 9), -1};
+            operation.price = (operation.is_bid) ? uniform(980, 1010) : uniform(990, 1020);
+
+            if (roll < 50 || issued.empty()) {
+                return operation;
+            } else if (roll < 60) {
+                operation.kind = Operation::fill_and_kill;
+            } else if (roll < 64) {
+                operation.kind = Operation::market;
+            } else {
+                // Mostly recent orders from their own trader, sometimes another trader's or an id never issued
+                const size_t back = std::min<size_t>(issued.size(), 256);
+                const auto &[id, trader] = issued[issued.size() - 1 - size_t(uniform(0, int(back) - 1))];
+                operation.kind = (roll < 84) ? Operation::cancel : Operation::update;
+                operation.target = (uniform(0, 49) == 0) ? id + 1000000 : id;
+                operation.trader_id = (uniform(0, 19) == 0) ? trader + 1 : trader;
+                operation.quantity = uniform(1, 150);
+            }
+            return operation;
+        }
+
+        void issued_order(const int id, const int trader_id) {
+            if (id >= 0)
+                issued.emplace_back(id, trader_id);
+        }
+};
+
+int apply(ReferenceBook &book, const Operation &operation) {
+    switch (operation.kind) {
+        case Operation::limit:
+        case Operation::fill_and_kill: {
+            const OrderType order_type = (operation.kind == Operation::limit) ? OrderType::limit : OrderType::fill_and_kill;
+            return (operation.is_bid) ? book.bid(operation.quantity, operation.price, order_type, operation.trader_id) : book.ask(operation.quantity, operation.price, order_type, operation.trader_id);
+        }
+        case Operation::market:
+            return (operation.is_bid) ? book.market_bid(operation.quantity, operation.trader_id) : book.market_ask(operation.quantity, operation.trader_id);
+        case Operation::cancel:
+            book.cancel(operation.target, operation.trader_id);
+            return -1;
+        case Operation::update:
+            book.update(operation.target, operation.quantity, operation.trader_id);
+            return -1;
+    }
+    return -1;
+}
+
+template <typename Book>
+int apply(Book &book, const Operation &operation) {
+    switch (operation.kind) {
+        case Operation::limit:
+        case Operation::fill_and_kill: {
+            const OrderType order_type = (operation.kind == Operation::limit) ? OrderType::limit : OrderType::fill_and_kill;
+            return (operation.is_bid) ? book.bid(operation.quantity, operation.price, order_type, operation.trader_id) : book.ask(operation.quantity, operation.price, order_type, operation.trader_id);
+        }
+        case Operation::market:
+            return (operation.is_bid) ? book.market_bid(operation.quantity, operation.trader_id) : book.market_ask(operation.quantity, operation.trader_id);
+        case Operation::cancel:
+            book.cancel(operation.target, operation.trader_id);
+            return -1;
+        case Operation::update:
+            book.update(operation.target, operation.quantity, operation.trader_id);
+            return -1;
+    }
+    return -1;
+}
+
+// Applies operation to the reference and the book, returns false at the first difference
+template <typename Book>
+bool matches(ReferenceBook &reference, const int reference_id, Book &book, const Operation &operation) {
+    const bool same = apply(book, operation) == reference_id
+        && same_fills(book.get_fill_sink().transactions, reference.transactions)
+        && same_level_updates(book.get_fill_sink().level_updates, reference.level_updates);
+    book.get_fill_sink().clear();
+    return same;
+}
+
+// Every operation is compared on its fills and level updates, and the images every few hundred. Halfway
+// through both books are replaced by restores of their own images, which must carry on identically
+void test_random_flow(const uint32_t seed, const size_t operations) {
+    ReferenceBook reference;
+    auto map_book = std::make_unique<MapBook>();
+    auto ladder_book = std::make_unique<LadderBook>();
+    Flow flow(seed);
+
+    for (size_t i = 0; i < operations; i++) {
+        const Operation operation = flow.next();
+        const int id = apply(reference, operation);
+        flow.issued_order(id, operation.trader_id);
+
+        const bool map_matches = matches(reference, id, *map_book, operation);
+        const bool ladder_matches = matches(reference, id, *ladder_book, operation);
+        reference.clear_sink();
+        if (!map_matches || !ladder_matches) {
+            std::fprintf(stderr, "seed %u differs at operation %zu\n", seed, i);
+            CHECK(map_matches);
+            CHECK(ladder_matches);
+            return;
+        }
+
+        if (i % 500 == 499 || i + 1 == operations) {
+            const std::vector<unsigned char> expected = reference.snapshot();
+            CHECK(image_of(*map_book) == expected);
+            CHECK(image_of(*ladder_book) == expected);
+        }
+        if (i == operations / 2) {
+            auto map_restored = std::make_unique<MapBook>();
+            auto ladder_restored = std::make_unique<LadderBook>();
+            const std::vector<unsigned char> map_image = image_of(*map_book);
+            const std::vector<unsigned char> ladder_image = image_of(*ladder_book);
+            map_restored->restore(map_image.data(), map_image.size());
+            ladder_restored->restore(ladder_image.data(), ladder_image.size());
+            map_book = std::move(map_restored);
+            ladder_book = std::move(ladder_restored);
+        }
+    }
+}
+
+// levels levels of asks, two orders each, swept by one market bid and then by a limit bid which rests
+// its remainder. Compared like the random flow, the reference recurses once per level
+template <typename Book>
+void test_deep_sweep(const int levels) {
+    ReferenceBook reference;
+    Book book;
+
+    for (int level = 0; level < levels; level++) {
+        for (int trader = 1; trader <= 2; trader++) {
+            const Operation rest{Operation::limit, false, trader * 3, 1 + level, trader, -1};
+            const int id = apply(reference, rest);
+            CHECK(matches(reference, id, book, rest));
+            reference.clear_sink();
+        }
+    }
+
+    const Operation market{Operation::market, true, 9 * (levels / 2) + 1, 0, 3, -1};
+    const Operation limit{Operation::limit, true, 10 * levels, levels, 4, -1};
+    for (const Operation &sweep : {market, limit}) {
+        const int id = apply(reference, sweep);
+        CHECK(matches(reference, id, book, sweep));
+        reference.clear_sink();
+    }
+    CHECK(image_of(book) == reference.snapshot());
+    CHECK(book.get_best_ask() == nullptr && book.get_best_bid() != nullptr);
+}
+
+// A sweep across a million levels, far deeper than the reference could recurse, only checked for its totals
+// Any arguments are passed on to the book's constructor after its capacities
+template <typename Book, typename... BookArgs>
+void test_million_level_sweep(const BookArgs&... book_args) {
+    const int levels = 1000000;
+    Book book(levels, levels, book_args...);
+    for (int level = 0; level < levels; level++)
+        book.ask(1, 1 + level, OrderType::limit, 1);
+    book.get_fill_sink().clear();
+
+    CHECK(book.market_bid(levels, 2) >= 0);
+    const auto &sink = book.get_fill_sink();
+    CHECK(sink.transactions.size() == size_t(levels) && sink.level_updates.size() == size_t(levels));
+    CHECK(!sink.transactions.empty() && sink.transactions.front().price == 1 && sink.transactions.back().price == levels);
+    CHECK(book.get_best_ask() == nullptr && book.get_best_bid() == nullptr);
+}
+
+}
+
+int main() {
+    for (const uint32_t seed : {1u, 2u, 3u, 42u, 2024u})
+        test_random_flow(seed, 20000);
+
+    test_deep_sweep<MapBook>(5000);
+    test_deep_sweep<LadderBook>(5000);
+
+    LadderPriceLevels<LimitLevel>::Config wide_ladder;
+    wide_ladder.max_price = 1 << 21;
+    test_million_level_sweep<MapBook>();
+    test_million_level_sweep<LadderBook>(wide_ladder);
+
+    return report("differential_test");
+}
@@ -0,0 +1,192 @@
+// Drives ws_server's shard threads directly, without sockets
+// Build from the repository root with boost and disruptorplus on the include path:
+// c++ -O2 -Wall -std=c++17 tests/server_tests.cpp -o server_tests -pthread
+
+#define WS_SERVER_NO_MAIN
+#include "../ws_server.cpp"
+#include "check.hpp"
+#include <cstdio>
+
+namespace {
+
+// Waits up to a few seconds for a barrier to reach sequence, a matcher which has hung never gets there
+bool reaches(const disruptorplus::sequence_barrier<ConfigurableWaitStrategy> &barrier, disruptorplus::sequence_t sequence) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (disruptorplus::difference(barrier.last_published(), sequence) < 0) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// A market order sweeping more resting orders than the result rings hold must not stall the matcher:
+// 200 one lot asks rest, then one market bid takes all of them, producing 401 responses and over 400
+// market data records from a single event against rings of 64 slots
+void test_sweep_larger_than_result_rings() {
+    const size_t ring_size = 64;
+    const uint32_t resting = 200;
+    const std::string path = "server_tests_journal.bin";
+    std::remove(path.c_str());
+
+    // The shard threads never return and are left running until the program exits, so everything they
+    // touch is leaked rather than destroyed under them
+    pipeline &p = *new pipeline(1, 1, ring_size, ring_size, WaitMode::yield);
+    shard &s = *p.shards[0];
+    BookManager<server_book> &books = *new BookManager<server_book>(1, 0, 1);
+    JournalWriter<Event> &journal = *new JournalWriter<Event>(path, journal_tag(0, 1, 1));
+
+    std::thread(consumer, std::ref(s), std::ref(books), p.tops.get()).detach();
+    std::thread(journaller, std::ref(s), std::ref(journal)).detach();
+    std::thread(responder, std::ref(s), std::ref(p.sessions)).detach();
+    std::thread(market_data_fanout, std::ref(s), std::ref(p.market_data)).detach();
+
+    std::vector<Event> events;
+    for (uint32_t i = 0; i < resting; i++)
+        events.push_back({ask_command, OrderType::limit, 0, 1, 100 + i, 1, 1, 0});
+    events.push_back({bid_command, OrderType::market, 0, resting, 0, 2, 2, 0});
+    // One publish of more events than the ring holds, which has to be claimed a ring at a time. Published
+    // from another thread, a stalled matcher stops freeing event slots and would block it
+    std::thread([&s, events]() {
+        s.publish(events.size(), 0, [&events](Event &slot, size_t i) { slot = events[i]; });
+    }).detach();
+
+    // One ack per ask, then the market bid's ack and two responses for each of its fills
+    const uint64_t responses = resting + 1 + 2 * resting;
+    CHECK(reaches(s.events_consumed, events.size() - 1));
+    CHECK(reaches(s.responses_consumed, responses - 1));
+    CHECK(reaches(s.market_data_consumed, s.market_data_claim_strategy.last_published()));
+
+    server_book *book = books.find(0);
+    CHECK(book != nullptr && book->get_best_ask() == nullptr && book->get_best_bid() == nullptr);
+}
+
+std::vector<Response> apply(BookManager<server_book> &books, const Event &event) {
+    std::vector<Response> responses;
+    apply_event(books, event, [&responses](const Response &response) { responses.push_back(response); }, [](uint32_t, server_book&) {});
+    return responses;
+}
+
+// Each side of a fill is reported with the id of its own order, on a symbol other than 0 so ids are global
+void test_fill_reports_carry_each_order_id() {
+    BookManager<server_book> books(4, 0, 1);
+    const std::vector<Response> rested = apply(books, {ask_command, OrderType::limit, 3, 5, 100, 1, 1, 0});
+    const std::vector<Response> taken = apply(books, {bid_command, OrderType::limit, 3, 5, 100, 2, 2, 0});
+
+    CHECK(rested.size() == 1 && rested[0].kind == 'O');
+    CHECK(taken.size() == 3 && taken[0].kind == 'O');
+    if (rested.size() != 1 || taken.size() != 3)
+        return;
+    const int32_t maker_id = rested[0].order_id;
+    const int32_t taker_id = taken[0].order_id;
+    CHECK(maker_id != taker_id && books.symbol_of(maker_id) == 3 && books.symbol_of(taker_id) == 3);
+    CHECK(taken[1].kind == 'T' && taken[1].session_id == 2 && taken[1].order_id == taker_id);
+    CHECK(taken[2].kind == 'T' && taken[2].session_id == 1 && taken[2].order_id == maker_id);
+    CHECK(taken[2].price == 100 && taken[2].quantity == 5);
+}
+
+// Cancels and updates are only confirmed when they changed the book
+void test_cancel_and_update_report_failure() {
+    BookManager<server_book> books(1, 0, 1);
+    const std::vector<Response> rested = apply(books, {bid_command, OrderType::limit, 0, 5, 100, 1, 1, 0});
+    CHECK(rested.size() == 1 && rested[0].kind == 'O');
+    const uint32_t id = uint32_t(rested[0].order_id);
+
+    // Another trader's order, then an id never issued
+    CHECK(apply(books, {cancel_command, OrderType::limit, 0, id, 0, 2, 2, 0})[0].kind == 'X');
+    CHECK(apply(books, {update_command, OrderType::limit, 0, id, 3, 2, 2, 0})[0].kind == 'X');
+    CHECK(apply(books, {cancel_command, OrderType::limit, 0, id + 1, 0, 1, 1, 0})[0].kind == 'X');
+    CHECK(apply(books, {update_command, OrderType::limit, 0, id + 1, 3, 1, 1, 0})[0].kind == 'X');
+    CHECK(books.find(0)->get_best_bid() != nullptr && books.find(0)->get_best_bid()->quantity == 5);
+
+    CHECK(apply(books, {update_command, OrderType::limit, 0, id, 3, 1, 1, 0})[0].kind == 'U');
+    CHECK(books.find(0)->get_best_bid()->quantity == 3);
+    CHECK(apply(books, {cancel_command, OrderType::limit, 0, id, 0, 1, 1, 0})[0].kind == 'C');
+    CHECK(books.find(0)->get_best_bid() == nullptr);
+    // Already gone
+    CHECK(apply(books, {cancel_command, OrderType::limit, 0, id, 0, 1, 1, 0})[0].kind == 'X');
+    CHECK(apply(books, {update_command, OrderType::limit, 0, id, 3, 1, 1, 0})[0].kind == 'X');
+}
+
+// Parses the options after the program name, leaving config with its defaults first
+bool parses(std::vector<std::string> options, server_config &config) {
+    config = server_config();
+    options.insert(options.begin(), "ws_server");
+    std::vector<char*> argv;
+    for (std::string &option : options)
+        argv.push_back(&option[0]);
+    return parse_config(int(argv.size()), argv.data(), config);
+}
+
+void test_shard_layout_options() {
+    server_config config;
+    CHECK(parses({}, config) && config.matchers == 2 && config.symbols == 256);
+    CHECK(parses({"--matchers", "4", "--symbols", "1024"}, config) && config.matchers == 4 && config.symbols == 1024);
+    CHECK(parses({"--symbols", "65536"}, config) && config.symbols == 65536);
+
+    CHECK(!parses({"--symbols", "0"}, config));
+    CHECK(!parses({"--symbols", "65537"}, config));
+    CHECK(!parses({"--matchers", "0"}, config));
+    CHECK(!parses({"--matchers", "9", "--symbols", "8"}, config));
+}
+
+// Session batches are published with one claim each, so they never exceed the ring
+void test_batches_fit_the_ring() {
+    server_config config;
+    CHECK(parses({"throughput"}, config) && config.session.max_batch == 1024);
+    CHECK(parses({"throughput", "--ring-size", "256"}, config) && config.session.max_batch == 256);
+    CHECK(parses({"--ring-size", "16", "throughput"}, config) && config.session.max_batch == 16);
+    CHECK(parses({"--ring-size", "32"}, config) && config.session.max_batch == 32);
+}
+
+void test_matcher_core_options() {
+    server_config config;
+    const size_t cores = std::thread::hardware_concurrency();
+
+    // The list sets the number of matchers, or has to agree with --matchers
+    CHECK(parses({"--matcher-cores", "0"}, config) && config.matchers == 1 && config.matcher_cores.size() == 1);
+    CHECK(parses({"--matcher-cores", "0,0,0", "--matchers", "3"}, config) && config.matchers == 3);
+    CHECK(!parses({"--matchers", "2", "--matcher-cores", "0,0,0"}, config));
+
+    // Cores the machine doesn't have are refused rather than wrapped
+    if (cores > 0) {
+        CHECK(parses({"--matcher-cores", std::to_string(cores - 1)}, config));
+        CHECK(!parses({"--matcher-cores", std::to_string(cores)}, config));
+        CHECK(!parses({"--io-cores", "0," + std::to_string(cores)}, config));
+    }
+    CHECK(!parses({"--matcher-cores", "100000"}, config));
+}
+
+// Text orders only accept the order types the binary protocol does, anything else is rejected
+void test_text_order_types() {
+    Event event;
+    CHECK(parse_command("B 5 100", event) && event.order_type == OrderType::limit);
+    CHECK(parse_command("B 5 100 0", event) && event.order_type == OrderType::limit);
+    CHECK(parse_command("A 5 100 2 3", event) && event.order_type == OrderType::market && event.symbol == 3);
+    CHECK(parse_command("B 5 100 6", event) && event.order_type == OrderType::post_only_slide);
+
+    CHECK(!parse_command("B 5 100 -1", event));
+    CHECK(!parse_command("B 5 100 7", event));
+    CHECK(!parse_command("B 5 100 8", event));
+    CHECK(!parse_command("B 5 100 99", event));
+    CHECK(!parse_command("B 5 100 stop", event));
+}
+
+}
+
+int main() {
+    test_text_order_types();
+    test_shard_layout_options();
+    test_batches_fit_the_ring();
+    test_matcher_core_options();
+    test_fill_reports_carry_each_order_id();
+    test_cancel_and_update_report_failure();
+    test_sweep_larger_than_result_rings();
+    std::remove("server_tests_journal.bin");
+
+    // Detached shard threads are still spinning, so leave without running destructors
+    std::fflush(stdout);
+    const int status = report("server_tests");
+    std::fflush(stdout);
+    std::_Exit(status);
+}
@@ -0,0 +1,117 @@
+// Checks that restore refuses damaged or crafted images and leaves the book empty
+// Build from the repository root:
+// c++ -O2 -Wall -std=c++17 tests/snapshot_tests.cpp -o snapshot_tests
+
+#include "../limit_order_book.hpp"
+#include "check.hpp"
+#include <cstring>
+
+namespace {
+
+// Two bid levels and one ask level, three orders in all
+std::vector<unsigned char> valid_image() {
+    LimitOrderBook book;
+    book.bid(5, 99, OrderType::limit, 1);
+    book.bid(6, 100, OrderType::limit, 2);
+    book.ask(7, 101, OrderType::limit, 3);
+    std::vector<unsigned char> image;
+    book.snapshot(image);
+    return image;
+}
+
+SnapshotHeader header_of(const std::vector<unsigned char> &image) {
+    SnapshotHeader header;
+    std::memcpy(&header, image.data(), sizeof(header));
+    return header;
+}
+
+void set_header(std::vector<unsigned char> &image, const SnapshotHeader &header) {
+    std::memcpy(image.data(), &header, sizeof(header));
+}
+
+SnapshotLevel* levels_of(std::vector<unsigned char> &image) {
+    return reinterpret_cast<SnapshotLevel*>(image.data() + sizeof(SnapshotHeader));
+}
+
+SnapshotOrder* orders_of(std::vector<unsigned char> &image) {
+    const SnapshotHeader header = header_of(image);
+    return reinterpret_cast<SnapshotOrder*>(levels_of(image) + header.bid_levels + header.ask_levels);
+}
+
+// Restores into a fresh book, true if the image was refused and the book left empty
+template <typename Book = LimitOrderBook>
+bool refused(const std::vector<unsigned char> &image) {
+    Book book;
+    try {
+        book.restore(image.data(), image.size());
+    } catch (const std::invalid_argument&) {
+        return book.get_best_bid() == nullptr && book.get_best_ask() == nullptr;
+    }
+    return false;
+}
+
+void test_valid_image_restores() {
+    const std::vector<unsigned char> image = valid_image();
+    LimitOrderBook book;
+    CHECK(book.restore(image.data(), image.size()) == 0);
+    std::vector<unsigned char> again;
+    book.snapshot(again);
+    CHECK(again == image);
+}
+
+// Counts whose byte sizes wrap around to the real image size. Summed without overflow checks they pass the
+// size check and the validation then reads records past the end of the image, which only a build with
+// -fsanitize=address reports reliably
+void test_overflowing_counts_are_refused() {
+    // 2^61 stops of 40 bytes are 5 * 2^64 bytes, 0 modulo 2^64
+    std::vector<unsigned char> image = valid_image();
+    SnapshotHeader header = header_of(image);
+    header.stop_orders += uint64_t(1) << 61;
+    set_header(image, header);
+    CHECK(refused(image));
+
+    // 2^60 more orders of 24 bytes and 2^59 more ask levels of 16 bytes add 3 * 2^63 and 2^63
+    image = valid_image();
+    header = header_of(image);
+    header.orders += uint64_t(1) << 60;
+    header.ask_levels += uint64_t(1) << 59;
+    set_header(image, header);
+    CHECK(refused(image));
+
+    // A single count larger than the image
+    image = valid_image();
+    header = header_of(image);
+    header.stop_orders = UINT64_MAX / sizeof(SnapshotStop) + 1;
+    set_header(image, header);
+    CHECK(refused(image));
+}
+
+void test_duplicate_ids_are_refused() {
+    std::vector<unsigned char> image = valid_image();
+    SnapshotOrder *orders = orders_of(image);
+    orders[2].id = orders[0].id;
+    CHECK(refused(image));
+    CHECK(refused<LadderLimitOrderBook>(image));
+}
+
+// The best bid at or above the best ask would never have been left resting by matching
+void test_crossed_book_is_refused() {
+    std::vector<unsigned char> image = valid_image();
+    SnapshotLevel *levels = levels_of(image);
+    levels[2].price = 100;  // The only ask level, down onto the best bid
+    CHECK(refused(image));
+
+    levels[2].price = 98;  // Through both bid levels
+    CHECK(refused(image));
+    CHECK(refused<LadderLimitOrderBook>(image));
+}
+
+}
+
+int main() {
+    test_valid_image_restores();
+    test_overflowing_counts_are_refused();
+    test_duplicate_ids_are_refused();
+    test_crossed_book_is_refused();
+    return report("snapshot_tests");
+}
@@ -0,0 +1,125 @@
+#ifndef TOP_OF_BOOK_H
+#define TOP_OF_BOOK_H
+
+#include "book_types.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Best levels of a book, published by the thread which owns the book for any number of reader threads
+//
+// Books are only ever touched by their own thread, so other threads must not follow get_best_bid() and
+// friends into them. The owner instead copies the levels it cares about into a TopOfBook after each batch
+// of events and stores it in a Seqlock, which readers copy out of without locks, without writing to any
+// shared cache line and without the owner ever waiting on them
+
+// Up to Depth levels per side, best price first, counts say how many are filled in
+template <size_t Depth = 8, typename Types = DefaultBookTypes>
+struct TopOfBook {
+    using price_type = typename Types::price_type;
+    using quantity_type = typename Types::quantity_type;
+    static constexpr size_t depth = Depth;
+
+    uint64_t sequence;  // Supplied by the publisher, the server uses the last event sequence applied
+    uint32_t bid_levels;
+    uint32_t ask_levels;
+    price_type bid_prices[Depth];
+    quantity_type bid_quantities[Depth];
+    price_type ask_prices[Depth];
+    quantity_type ask_quantities[Depth];
+};
+
+// Fills top from the book's best levels, must run on the book's own thread
+template <typename Book, size_t Depth, typename Types>
+inline void capture_top_of_book(const Book &book, const uint64_t sequence, TopOfBook<Depth, Types> &top) {
+    top.sequence = sequence;
+    top.bid_levels = uint32_t(book.depth(true, Depth, top.bid_prices, top.bid_quantities));
+    top.ask_levels = uint32_t(book.depth(false, Depth, top.ask_prices, top.ask_quantities));
+}
+
+// Single writer, many reader sequence lock over a trivially copyable value
+//
+// The writer makes the version odd, stores the value and makes it even again. A reader copies the value
+// between two reads of the version and keeps the copy only if both were the same even number. The value
+// is held in relaxed atomic words rather than as a plain object, so a copy torn by a concurrent store is
+// detected and discarded instead of being a data race. The version and the value sit on their own cache
+// lines, so neighbouring Seqlocks written by other threads never share a line with this one
+template <typename T>
+class Seqlock final {
+    private:
+        static_assert(std::is_trivially_copyable<T>::value, "Seqlock values are copied as raw words");
+        static constexpr size_t word_count = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+        alignas(64) std::atomic<uint64_t> version{0};
+        alignas(64) std::atomic<uint64_t> words[word_count];
+
+    public:
+        Seqlock() {
+            for (std::atomic<uint64_t> &word : words) {
+                word.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        Seqlock(const Seqlock&) = delete;
+        Seqlock& operator=(const Seqlock&) = delete;
+
+        // Only ever called by the one writing thread, never waits
+        inline void store(const T &value) {
+            uint64_t buffer[word_count] = {};
+            std::memcpy(buffer, &value, sizeof(T));
+
+            const uint64_t start = version.load(std::memory_order_relaxed);
+            version.store(start + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < word_count; i++) {
+                words[i].store(buffer[i], std::memory_order_relaxed);
+            }
+            version.store(start + 2, std::memory_order_release);
+        }
+
+        // One wait-free attempt, false if a store was under way and value was left unchanged
+        inline bool try_load(T &value) const {
+            const uint64_t start = version.load(std::memory_order_acquire);
+            if (start & 1) {
+                return false;
+            }
+
+            uint64_t buffer[word_count];
+            for (size_t i = 0; i < word_count; i++) {
+                buffer[i] = words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (version.load(std::memory_order_relaxed) != start) {
+                return false;
+            }
+
+            std::memcpy(&value, buffer, sizeof(T));
+            return true;
+        }
+
+        // Retries until a copy is taken, only waits while a store is under way
+        inline T load() const {
+            T value;
+            while (!try_load(value)) {
+#if defined(__x86_64__) || defined(__i386__)
+                _mm_pause();
+#else
+                std::this_thread::yield();
+#endif
+            }
+            return value;
+        }
+
+        // Number of stores so far
+        inline uint64_t stores() const {
+            return version.load(std::memory_order_acquire) / 2;
+        }
+};
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef TRADER_H
+#define TRADER_H
+
+#include "limit_order_book.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Agent based market simulation run entirely in native code
+// Every trader holds at most one resting order, acting cancels it and submits a fresh one priced by the
+// trader's strategy. Limit prices are private values, a buyer never pays more and a seller never accepts less
+
+enum class Strategy : uint8_t {
+    zic,     // Zero intelligence constrained, uniform random price on the profitable side of the limit
+    zip,     // Zero intelligence plus, a profit margin adapted towards recent trade prices
+    shaver   // Improves the best price on its side by one tick while staying inside its limit
+};
+
+// What a trader can see of the market when it acts
+struct MarketState {
+    int min_price;
+    int max_price;
+    int best_bid;          // -1 when the side is empty
+    int best_ask;          // -1 when the side is empty
+    int last_trade_price;  // -1 before the first trade
+};
+
+class Trader final {
+    public:
+        static constexpr int random_limit_price = -1;
+
+        bool is_buyer;
+        bool is_seller;
+        Strategy strategy;
+        int limit_price;  // random_limit_price draws one uniformly from the experiment's price band
+        int quantity;
+
+        // Assigned by run_experiment, trader_id is the trader's index in the TraderVector
+        int trader_id = -1;
+        int order_id = -1;
+        bool order_is_bid = false;
+
+        // ZIP state, margin is relative to limit_price
+        double margin = 0.0;
+        double learning_rate = 0.0;
+        double momentum = 0.0;
+        double last_change = 0.0;
+
+        int64_t profit = 0;
+        int64_t traded_quantity = 0;
+
+        Trader(const bool _is_buyer, const bool _is_seller, const Strategy _strategy = Strategy::zic, const int _limit_price = random_limit_price, const int _quantity = 1)
+            : is_buyer(_is_buyer), is_seller(_is_seller), strategy(_strategy), limit_price(_limit_price), quantity(_quantity) {}
+
+        template <typename Rng>
+        inline void reset(const int id, const MarketState &market, Rng &rng) {
+            trader_id = id;
+            order_id = -1;
+            profit = 0;
+            traded_quantity = 0;
+            last_change = 0.0;
+
+            if (limit_price == random_limit_price) {
+                limit_price = std::uniform_int_distribution<int>(market.min_price, market.max_price)(rng);
+            }
+
+            // Initial ranges from Cliff's ZIP paper
+            std::uniform_real_distribution<double> unit(0.0, 1.0);
+            margin = 0.05 + 0.3 * unit(rng);
+            learning_rate = 0.1 + 0.4 * unit(rng);
+            momentum = 0.1 * unit(rng);
+        }
+
+        template <typename Rng>
+        inline int get_order_price(const bool is_bid, const MarketState &market, Rng &rng) const {
+            switch (strategy) {
+                case Strategy::zip:
+                    return std::clamp(int((is_bid) ? limit_price * (1.0 - margin) : limit_price * (1.0 + margin)), market.min_price, market.max_price);
+                case Strategy::shaver:
+                    if (is_bid) {
+                        return (market.best_bid == -1) ? market.min_price : std::min(market.best_bid + 1, limit_price);
+                    }
+                    return (market.best_ask == -1) ? market.max_price : std::max(market.best_ask - 1, limit_price);
+                default:
+                    if (is_bid) {
+                        return std::uniform_int_distribution<int>(market.min_price, std::max(limit_price, market.min_price))(rng);
+                    }
+                    return std::uniform_int_distribution<int>(std::min(limit_price, market.max_price), market.max_price)(rng);
+            }
+        }
+
+        // Widrow-Hoff step of the ZIP margin towards a price just beyond the last trade
+        template <typename Rng>
+        inline void observe_trade(const int trade_price, Rng &rng) {
+            if (strategy != Strategy::zip || order_id == -1) {
+                return;
+            }
+
+            std::uniform_real_distribution<double> perturbation(0.0, 0.05);
+            const double price = (order_is_bid) ? limit_price * (1.0 - margin) : limit_price * (1.0 + margin);
+
+            // Raise the margin when the market would have given more, lower it when the quote was beaten
+            const bool widen = (order_is_bid) ? trade_price <= price : trade_price >= price;
+            const bool raise_price = (order_is_bid) ? !widen : widen;
+            const double target = (raise_price) ? trade_price * (1.0 + perturbation(rng)) : trade_price * (1.0 - perturbation(rng));
+
+            last_change = momentum * last_change + (1.0 - momentum) * learning_rate * (target - price);
+            const double new_price = price + last_change;
+
+            if (order_is_bid) {
+                margin = std::clamp(1.0 - new_price / limit_price, 0.0, 1.0);
+            } else {
+                margin = std::max(new_price / limit_price - 1.0, 0.0);
+            }
+        }
+};
+
+struct ExperimentSummary {
+    int steps = 0;
+    int64_t orders_submitted = 0;
+    int64_t fills = 0;
+    int64_t volume = 0;
+    double vwap = 0.0;
+    int min_trade_price = -1;
+    int max_trade_price = -1;
+    int last_trade_price = -1;
+    int64_t total_profit = 0;  // Sum of every trader's surplus against its limit price
+};
+
+// Runs time steps [start, end), each step gives traders.size() randomly chosen traders a turn to act
+// Fills are left in the book's VectorFillSink, seed makes the whole run reproducible
+template <typename Book>
+ExperimentSummary run_experiment(Book &book, const int start, const int end, std::vector<Trader> &traders, const uint64_t seed = 0, const int min_price = 1, const int max_price = 200) {
+    std::mt19937_64 rng(seed);
+    ExperimentSummary summary;
+    MarketState market{min_price, max_price, -1, -1, -1};
+    std::vector<Transaction> &transactions = book.get_fill_sink().transactions;
+
+    if (traders.empty() || start >= end) {
+        return summary;
+    }
+
+    bool any_zip = false;
+    for (size_t i = 0; i < traders.size(); i++) {
+        traders[i].reset(int(i), market, rng);
+        any_zip |= (traders[i].strategy == Strategy::zip);
+    }
+
+    std::uniform_int_distribution<size_t> pick(0, traders.size() - 1);
+    std::bernoulli_distribution coin;
+    double notional = 0.0;
+
+    for (int time = start; time < end; time++) {
+        const size_t first_fill = transactions.size();
+
+        for (size_t turn = 0; turn < traders.size(); turn++) {
+            Trader &trader = traders[pick(rng)];
+            if (!trader.is_buyer && !trader.is_seller) {
+                continue;
+            }
+
+            // Cancel is a no-op once the previous order has been filled
+            if (trader.order_id != -1) {
+                book.cancel(trader.order_id, trader.trader_id);
+            }
+
+            const LimitLevel *best_bid = book.get_best_bid();
+            const LimitLevel *best_ask = book.get_best_ask();
+            market.best_bid = (best_bid != nullptr) ? best_bid->price : -1;
+            market.best_ask = (best_ask != nullptr) ? best_ask->price : -1;
+
+            const bool is_bid = (trader.is_buyer && trader.is_seller) ? coin(rng) : trader.is_buyer;
+            const int price = trader.get_order_price(is_bid, market, rng);
+
+            // The trader's side is recorded before matching so its own fills are attributed correctly
+            trader.order_is_bid = is_bid;
+            const size_t before = transactions.size();
+            trader.order_id = (is_bid)
+                ? book.bid(trader.quantity, price, OrderType::limit, trader.trader_id)
+                : book.ask(trader.quantity, price, OrderType::limit, trader.trader_id);
+            summary.orders_submitted++;
+
+            for (size_t i = before; i < transactions.size(); i++) {
+                const Transaction &fill = transactions[i];
+                for (const int id : {fill.trader_one, fill.trader_two}) {
+                    // Orders placed on the book outside the experiment are not attributed
+                    if (id < 0 || size_t(id) >= traders.size()) {
+                        continue;
+                    }
+                    Trader &party = traders[id];
+                    party.profit += int64_t((party.order_is_bid) ? party.limit_price - fill.price : fill.price - party.limit_price) * fill.quantity;
+                    party.traded_quantity += fill.quantity;
+                }
+            }
+        }
+
+        for (size_t i = first_fill; i < transactions.size(); i++) {
+            const Transaction &fill = transactions[i];
+            summary.fills++;
+            summary.volume += fill.quantity;
+            notional += double(fill.price) * fill.quantity;
+            summary.min_trade_price = (summary.min_trade_price == -1) ? fill.price : std::min(summary.min_trade_price, fill.price);
+            summary.max_trade_price = std::max(summary.max_trade_price, fill.price);
+            market.last_trade_price = fill.price;
+        }
+
+        // ZIP traders learn once per step from the step's last trade, keeping a step O(traders)
+        if (any_zip && transactions.size() > first_fill) {
+            for (Trader &trader : traders) {
+                trader.observe_trade(market.last_trade_price, rng);
+            }
+        }
+        summary.steps++;
+    }
+
+    summary.last_trade_price = market.last_trade_price;
+    summary.vwap = (summary.volume > 0) ? notional / summary.volume : 0.0;
+    for (const Trader &trader : traders) {
+        summary.total_profit += trader.profit;
+    }
+    return summary;
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef WAIT_STRATEGY_H
+#define WAIT_STRATEGY_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// How a thread waiting on a ring waits for the next sequence to be published
+//   spin   polls with only a pause between reads, lowest latency but burns its core, for pinned threads
+//   yield  gives up its time slice between reads, so threads sharing a core still make progress
+//   block  sleeps on a condition variable until a publisher signals, frees the core at the cost of a wake-up
+enum class WaitMode : uint8_t { spin, yield, block };
+
+// Disruptor wait strategy whose mode is chosen at runtime, so one build of the server can be configured
+// for a dedicated box or a shared one. Implements what the disruptorplus claim strategies and sequence
+// barriers call: wait_until_published for one or several sequences, and signal_all_when_blocking after
+// every publish, which is a single predictable branch unless blocking
+class ConfigurableWaitStrategy final {
+    private:
+        const WaitMode mode;
+        std::mutex mutex;
+        std::condition_variable published;
+
+        // Sequences wrap, so they are compared by signed distance like disruptorplus::difference
+        template <typename Sequence>
+        static inline bool _reached(const Sequence current, const Sequence sequence) {
+            return typename std::make_signed<Sequence>::type(current - sequence) >= 0;
+        }
+
+        template <typename Sequence>
+        static inline Sequence _minimum(const size_t count, const std::atomic<Sequence>* const sequences[]) {
+            Sequence minimum = sequences[0]->load(std::memory_order_acquire);
+            for (size_t i = 1; i < count; i++) {
+                const Sequence current = sequences[i]->load(std::memory_order_acquire);
+                if (!_reached(current, minimum)) {
+                    minimum = current;
+                }
+            }
+            return minimum;
+        }
+
+        inline void _relax() const {
+#if defined(__x86_64__) || defined(__i386__)
+            if (mode == WaitMode::spin) {
+                _mm_pause();
+                return;
+            }
+#endif
+            std::this_thread::yield();
+        }
+
+        // read(value) loads the current sequence into value and says whether it has been reached.
+        // Blocking waiters recheck under the mutex signal_all_when_blocking takes, so no wake-up is lost
+        template <typename Sequence, typename Read>
+        inline Sequence _wait(Read read) {
+            Sequence current;
+            if (mode == WaitMode::block) {
+                std::unique_lock<std::mutex> lock(mutex);
+                published.wait(lock, [&] { return read(current); });
+                return current;
+            }
+
+            while (!read(current)) {
+                _relax();
+            }
+            return current;
+        }
+
+    public:
+        explicit ConfigurableWaitStrategy(const WaitMode _mode = WaitMode::spin) : mode(_mode) {}
+
+        ConfigurableWaitStrategy(const ConfigurableWaitStrategy&) = delete;
+        ConfigurableWaitStrategy& operator=(const ConfigurableWaitStrategy&) = delete;
+
+        inline WaitMode get_mode() const {
+            return mode;
+        }
+
+        // Waits until published_sequence reaches sequence and returns its value, which may be further on
+        template <typename Sequence>
+        inline Sequence wait_until_published(const Sequence sequence, const std::atomic<Sequence> &published_sequence) {
+            const Sequence current = published_sequence.load(std::memory_order_acquire);
+            if (_reached(current, sequence)) {
+                return current;
+            }
+
+            return _wait<Sequence>([&](Sequence &value) {
+                value = published_sequence.load(std::memory_order_acquire);
+                return _reached(value, sequence);
+            });
+        }
+
+        // As above for the slowest of count sequences, claims wait on every consumer of a ring this way
+        template <typename Sequence>
+        inline Sequence wait_until_published(const Sequence sequence, const size_t count, const std::atomic<Sequence>* const sequences[]) {
+            const Sequence current = _minimum(count, sequences);
+            if (_reached(current, sequence)) {
+                return current;
+            }
+
+            return _wait<Sequence>([&](Sequence &value) {
+                value = _minimum(count, sequences);
+                return _reached(value, sequence);
+            });
+        }
+
+        // Called by publishers after every publish
+        inline void signal_all_when_blocking() {
+            if (mode == WaitMode::block) {
+                std::lock_guard<std::mutex> lock(mutex);
+                published.notify_all();
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,284 @@
+#ifndef WIRE_PROTOCOL_H
+#define WIRE_PROTOCOL_H
+
+#include "order_queue.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Order entry protocol spoken by ws_server
+//
+// Text frames carry one command per line:
+// Bid = B {quantity} {price} [order_type] [symbol]
+// Ask = A {quantity} {price} [order_type] [symbol]
+// Cancel = C {id}
+// Update = U {id} {quantity}
+// Replace = R {id} {price} {quantity}, moves a resting order to a new price and quantity keeping its id, text only
+// Subscribe = S {symbol} [depth], depth 1 for best bid and ask, 2 (the default) for every level
+// Latency stats = H, answered with one line per stage: H {stage} {count} {p50} {p99} {p99.9} {max} in ns
+// Top of book = D {symbol}, answered from the matcher's last published top with D {symbol} {B|A} {price} {quantity}
+// per level, best first, then D {symbol} to end the list
+// Symbols default to 0, order ids already identify their symbol
+// order_type is an OrderType value up to post_only_slide, stop orders need a stop price the messages have no room for
+// and replaces need a third field, so both are left out of the binary protocol
+//
+// Binary frames carry any number of packed 12 byte little-endian messages, laid out exactly like the
+// first 12 bytes of Event so they are copied straight into a ring buffer slot:
+// [0] command, [1] order_type, [2..3] symbol, [4..7] field_one, [8..11] field_two
+// Replies use the same framing as the request, binary replies are the first 16 bytes of Response
+//
+// Market data for subscribed symbols is sent as text lines or packed 12 byte MarketDataEvents:
+// L {symbol} {B|A} {price} {quantity}   aggregate quantity at a level, 0 once it has gone
+// Q {symbol} {B|A} {price} {quantity}   best level of one side, 0 0 when the side is empty
+// P {symbol} {price} {quantity}         trade print
+
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The binary wire format is copied directly into Event and requires a little-endian host"
+#endif
+
+enum Command : uint8_t {
+    bid_command = 0,
+    ask_command = 1,
+    cancel_command = 2,
+    update_command = 3,
+    subscribe_command = 4,  // Handled by the session, never enters the ring
+    stats_command = 5,      // Text only, handled by the session
+    replace_command = 6,    // Text only
+    top_command = 7         // Text only, handled by the session
+};
+
+// A command waiting in the ring buffer to be applied to the book
+struct Event {
+    uint8_t command;
+    OrderType order_type;
+    uint16_t symbol;  // Ignored by cancel and update
+    uint32_t field_one;
+    uint32_t field_two;
+    uint32_t trader_id;
+    uint32_t session_id;  // Session the command arrived on, results are routed back to it
+    uint32_t field_three;  // Replace only, the new quantity, field_one is the id and field_two the price
+};
+
+constexpr size_t wire_event_size = 12;
+
+static_assert(sizeof(OrderType) == 1 && offsetof(Event, field_one) == 4 && offsetof(Event, field_two) == 8 && offsetof(Event, trader_id) == wire_event_size,
+    "Event must start with the binary wire message layout");
+
+// A result produced by the matcher for one session
+struct Response {
+    char kind;  // 'O' order accepted, 'X' rejected, 'T' trade, 'C' cancel, 'U' update, 'R' replace
+    int32_t order_id;
+    uint32_t price;
+    uint32_t quantity;
+    uint32_t session_id;
+    uint64_t event_sequence = 0;  // Ring sequence of the event it answers, held back until that event is journaled
+    uint64_t received = 0;        // latency_ticks() when the event's message was read
+};
+
+constexpr size_t wire_response_size = 16;
+
+static_assert(offsetof(Response, order_id) == 4 && offsetof(Response, session_id) == wire_response_size,
+    "Response must start with the binary wire message layout");
+
+// One market data message, laid out as its binary wire record
+struct MarketDataEvent {
+    char kind;     // 'L' level, 'Q' quote, 'P' trade print
+    char side;     // 'B' or 'A', 0 for prints
+    uint16_t symbol;
+    int32_t price;
+    int32_t quantity;
+};
+
+static_assert(sizeof(MarketDataEvent) == 12, "MarketDataEvent is sent as is");
+
+inline std::vector<std::string> split (const std::string &s, char delim) {
+    std::vector<std::string> result;
+    std::stringstream ss (s);
+    std::string item;
+
+    while (getline (ss, item, delim)) {
+        result.push_back (item);
+    }
+
+    return result;
+}
+
+// False for values that aren't an order type and for stop types, which the messages can't carry
+inline bool to_order_type(const int order_type_id, OrderType &order_type) {
+    switch (order_type_id) {
+        case 0:
+            order_type = OrderType::limit;
+            return true;
+        case 1:
+            order_type = OrderType::fill_and_kill;
+            return true;
+        case 2:
+            order_type = OrderType::market;
+            return true;
+        case 3:
+            order_type = OrderType::immediate_or_cancel;
+            return true;
+        case 4:
+            order_type = OrderType::post_only;
+            return true;
+        case 5:
+            order_type = OrderType::fill_or_kill;
+            return true;
+        case 6:
+            order_type = OrderType::post_only_slide;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Parses one text command, the trader and session ids are filled in by the session
+inline bool parse_command(const std::string &line, Event &event) {
+    std::vector<std::string> tokens = split(line, ' ');
+    if (tokens.empty() || tokens[0].size() != 1) {
+        return false;
+    }
+    event.field_three = 0;
+
+    try {
+        switch (tokens[0][0]) {
+            case 'B':
+            case 'A':
+                if (tokens.size() < 3 || tokens.size() > 5) {
+                    return false;
+                }
+                event.command = (tokens[0][0] == 'B') ? bid_command : ask_command;
+                event.field_one = std::stoul(tokens[1]);
+                event.field_two = std::stoul(tokens[2]);
+                event.order_type = OrderType::limit;
+                if (tokens.size() >= 4 && !to_order_type(std::stoi(tokens[3]), event.order_type)) {
+                    return false;
+                }
+                if (tokens.size() == 5) {
+                    const unsigned long symbol = std::stoul(tokens[4]);
+                    if (symbol > UINT16_MAX) {
+                        return false;
+                    }
+                    event.symbol = uint16_t(symbol);
+                } else {
+                    event.symbol = 0;
+                }
+                return true;
+            case 'C':
+                if (tokens.size() != 2) {
+                    return false;
+                }
+                event.command = cancel_command;
+                event.field_one = std::stoul(tokens[1]);
+                event.field_two = 0;
+                event.symbol = 0;
+                return true;
+            case 'U':
+                if (tokens.size() != 3) {
+                    return false;
+                }
+                event.command = update_command;
+                event.field_one = std::stoul(tokens[1]);
+                event.field_two = std::stoul(tokens[2]);
+                event.symbol = 0;
+                return true;
+            case 'R':
+                if (tokens.size() != 4) {
+                    return false;
+                }
+                event.command = replace_command;
+                event.field_one = std::stoul(tokens[1]);
+                event.field_two = std::stoul(tokens[2]);
+                event.field_three = std::stoul(tokens[3]);
+                event.symbol = 0;
+                return true;
+            case 'S': {
+                if (tokens.size() < 2 || tokens.size() > 3) {
+                    return false;
+                }
+                const unsigned long symbol = std::stoul(tokens[1]);
+                if (symbol > UINT16_MAX) {
+                    return false;
+                }
+                event.command = subscribe_command;
+                event.symbol = uint16_t(symbol);
+                event.field_one = (tokens.size() == 3) ? std::stoul(tokens[2]) : 2;
+                event.field_two = 0;
+                return true;
+            }
+            case 'D': {
+                if (tokens.size() != 2) {
+                    return false;
+                }
+                const unsigned long symbol = std::stoul(tokens[1]);
+                if (symbol > UINT16_MAX) {
+                    return false;
+                }
+                event.command = top_command;
+                event.symbol = uint16_t(symbol);
+                event.field_one = 0;
+                event.field_two = 0;
+                return true;
+            }
+            case 'H':
+                if (tokens.size() != 1) {
+                    return false;
+                }
+                event.command = stats_command;
+                event.symbol = 0;
+                event.field_one = 0;
+                event.field_two = 0;
+                return true;
+            default:
+                return false;
+        }
+    } catch (const std::exception&) {
+        // Non numeric or out of range fields
+        return false;
+    }
+}
+
+// Checks a binary message before a ring slot is claimed for it, a claimed slot must always be published
+inline bool valid_wire_event(const unsigned char *message) {
+    return message[0] <= subscribe_command && message[1] <= static_cast<uint8_t>(OrderType::post_only_slide);
+}
+
+// Copies a validated binary message into the front of an Event, the rest is filled in by the session
+inline void decode_event(const unsigned char *message, Event &event) {
+    std::memcpy(&event, message, wire_event_size);
+    event.field_three = 0;
+}
+
+inline std::string format_response(const Response &response) {
+    switch (response.kind) {
+        case 'T':
+            return "T " + std::to_string(response.order_id) + " " + std::to_string(response.price) + " " + std::to_string(response.quantity);
+        case 'X':
+            return "X";
+        default:
+            return std::string(1, response.kind) + " " + std::to_string(response.order_id);
+    }
+}
+
+inline void encode_response(const Response &response, std::string &out) {
+    // Padding after kind is written as zeros rather than copied
+    out.push_back(response.kind);
+    out.append(3, '\0');
+    out.append(reinterpret_cast<const char*>(&response.order_id), wire_response_size - offsetof(Response, order_id));
+}
+
+inline void format_market_data(const MarketDataEvent &event, std::string &out) {
+    out += event.kind;
+    out += ' ';
+    out += std::to_string(event.symbol);
+    if (event.kind != 'P') {
+        out += ' ';
+        out += event.side;
+    }
+    out += ' ' + std::to_string(event.price) + ' ' + std::to_string(event.quantity) + '\n';
+}
+
+#endif
@@ -2,21 +2,43 @@
 #include <boost/beast/websocket.hpp>
 #include <boost/asio/dispatch.hpp>
 #include <boost/asio/strand.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <iterator>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 #include <cinttypes>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "book_manager.hpp"
+#include "journal.hpp"
+#include "latency_stats.hpp"
 #include "limit_order_book.hpp"
+#include "top_of_book.hpp"
+#include "wait_strategy.hpp"
+#include "wire_protocol.hpp"
 #include <disruptorplus/ring_buffer.hpp>
+#include <disruptorplus/multi_threaded_claim_strategy.hpp>
 #include <disruptorplus/single_threaded_claim_strategy.hpp>
-#include <disruptorplus/spin_wait_strategy.hpp>
 #include <disruptorplus/sequence_barrier.hpp>
+#include <disruptorplus/sequence_range.hpp>
 
 
 namespace beast = boost::beast;         // from <boost/beast.hpp>
@@ -30,27 +52,267 @@ void fail(beast::error_code ec, char const* what)
     std::cerr << what << ": " << ec.message() << "\n";
 }
 
-std::vector<std::string> split (const std::string &s, char delim) {
-    std::vector<std::string> result;
-    std::stringstream ss (s);
-    std::string item;
+class session;
 
-    while (getline (ss, item, delim)) {
-        result.push_back (item);
+// Maps session ids to live sessions so the responder thread can route results
+class session_registry
+{
+    std::mutex _mutex;
+    std::unordered_map<uint32_t, std::weak_ptr<session>> _sessions;
+
+public:
+    void add(uint32_t id, std::weak_ptr<session> s)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _sessions.emplace(id, std::move(s));
     }
 
-    return result;
-}
+    void remove(uint32_t id)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _sessions.erase(id);
+    }
+
+    std::shared_ptr<session> find(uint32_t id)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _sessions.find(id);
+        return (it != _sessions.end()) ? it->second.lock() : nullptr;
+    }
+};
+
+// Books used by the server, their sink also collects level updates for the market data feed
+using server_book = BasicLimitOrderBook<MapPriceLevels, MarketDataSink>;
+// Best levels of each book, published by its matcher after every batch that changes them
+using server_top = TopOfBook<10>;
+
+// Sessions subscribed to each symbol's market data
+class market_data_hub
+{
+    std::mutex _mutex;
+    std::unordered_map<uint32_t, std::vector<std::weak_ptr<session>>> _subscribers;
+
+public:
+    void subscribe(uint32_t symbol, std::weak_ptr<session> s)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _subscribers[symbol].push_back(std::move(s));
+    }
+
+    // Calls visit for each live subscriber of symbol, dropping sessions which have gone
+    template <typename Visitor>
+    void for_each_subscriber(uint32_t symbol, Visitor&& visit)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _subscribers.find(symbol);
+        if (it == _subscribers.end())
+            return;
+
+        auto& list = it->second;
+        for (size_t i = 0; i < list.size();) {
+            if (std::shared_ptr<session> s = list[i].lock()) {
+                visit(*s);
+                i++;
+            } else {
+                list[i] = std::move(list.back());
+                list.pop_back();
+            }
+        }
+    }
+};
+
+// One matcher thread's rings. Sessions publish events into a multi producer ring consumed by the matcher,
+// the matcher publishes results into a single producer ring drained by the shard's responder thread,
+// which hands them to the originating session's strand so the matcher never waits on a socket.
+// Market data takes a third ring to the shard's fan-out thread
+struct shard
+{
+    ConfigurableWaitStrategy wait_strategy;  // Shared by all three rings, see WaitMode
+
+    disruptorplus::ring_buffer<Event> events;
+    disruptorplus::multi_threaded_claim_strategy<ConfigurableWaitStrategy> event_claim_strategy;
+    disruptorplus::sequence_barrier<ConfigurableWaitStrategy> events_consumed;
+    disruptorplus::sequence_barrier<ConfigurableWaitStrategy> events_journaled;
+
+    // latency_ticks() when each event's message was read and when it was published, indexed like events
+    struct event_times { uint64_t received; uint64_t published; };
+    std::vector<event_times> times;
+
+    disruptorplus::ring_buffer<Response> responses;
+    disruptorplus::single_threaded_claim_strategy<ConfigurableWaitStrategy> response_claim_strategy;
+    disruptorplus::sequence_barrier<ConfigurableWaitStrategy> responses_consumed;
+
+    disruptorplus::ring_buffer<MarketDataEvent> market_data;
+    disruptorplus::single_threaded_claim_strategy<ConfigurableWaitStrategy> market_data_claim_strategy;
+    disruptorplus::sequence_barrier<ConfigurableWaitStrategy> market_data_consumed;
+    // Sequence of the event behind each market data slot, indexed like market_data
+    std::vector<disruptorplus::sequence_t> market_data_events;
+
+    // Buffer sizes must be powers of two
+    shard(size_t event_buffer_size, size_t response_buffer_size, WaitMode wait_mode)
+        : wait_strategy(wait_mode),
+          events(event_buffer_size),
+          event_claim_strategy(event_buffer_size, wait_strategy),
+          events_consumed(wait_strategy),
+          events_journaled(wait_strategy),
+          times(event_buffer_size),
+          responses(response_buffer_size),
+          response_claim_strategy(response_buffer_size, wait_strategy),
+          responses_consumed(wait_strategy),
+          market_data(response_buffer_size),
+          market_data_claim_strategy(response_buffer_size, wait_strategy),
+          market_data_consumed(wait_strategy),
+          market_data_events(response_buffer_size)
+    {
+        // Slots are only reused once both the matcher and the journaller have read them
+        event_claim_strategy.add_claim_barrier(events_consumed);
+        event_claim_strategy.add_claim_barrier(events_journaled);
+        response_claim_strategy.add_claim_barrier(responses_consumed);
+        market_data_claim_strategy.add_claim_barrier(market_data_consumed);
+    }
+
+    // Writes count events into the ring with fill(slot, i). A claim takes exactly the slots asked for, waiting
+    // until that many are free, and may not ask for more than the ring holds, so larger batches are claimed
+    // a ring at a time. A batch usually costs one claim and one publish rather than one of each per event
+    template <typename Fill>
+    void publish(size_t count, uint64_t received, Fill&& fill)
+    {
+        for (size_t done = 0; done < count;) {
+            const disruptorplus::sequence_range range = event_claim_strategy.claim(std::min(count - done, events.size()));
+            for (size_t i = 0; i < range.size(); i++) {
+                fill(events[range[i]], done + i);
+                stamp(range[i], received);
+            }
+            event_claim_strategy.publish(range);
+            done += range.size();
+        }
+    }
 
-// Echoes back all received WebSocket messages
+    // Writes every slot once before any thread runs, so no ring page is first touched on the hot path
+    void prefault(size_t event_buffer_size, size_t response_buffer_size)
+    {
+        for (size_t i = 0; i < event_buffer_size; i++)
+            events[i] = Event{};
+        for (size_t i = 0; i < response_buffer_size; i++) {
+            responses[i] = Response{};
+            market_data[i] = MarketDataEvent{};
+        }
+    }
+
+    void stamp(disruptorplus::sequence_t sequence, uint64_t received)
+    {
+        if constexpr (latency_stats_enabled)
+            times[sequence & (times.size() - 1)] = {received, latency_ticks()};
+    }
+};
+
+// Symbols are split across shards by BookManager::shard_of, each shard with its own matcher thread and rings.
+// Sessions route every event to its shard themselves, so matchers never see each other's traffic
+struct pipeline
+{
+    const uint32_t symbol_count;
+    const int id_bits;
+    std::vector<std::unique_ptr<shard>> shards;
+
+    session_registry sessions;
+    market_data_hub market_data;
+    std::atomic<uint32_t> next_session_id{0};
+
+    // Indexed by symbol, each written only by the symbol's matcher and read by any session
+    std::unique_ptr<Seqlock<server_top>[]> tops;
+
+    pipeline(size_t shard_count, uint32_t symbols, size_t event_buffer_size, size_t response_buffer_size, WaitMode wait_mode)
+        : symbol_count(symbols), id_bits(BookManager<>::id_bits_for(symbols)), tops(new Seqlock<server_top>[symbols])
+    {
+        for (size_t i = 0; i < shard_count; i++) {
+            shards.push_back(std::make_unique<shard>(event_buffer_size, response_buffer_size, wait_mode));
+            shards.back()->prefault(event_buffer_size, response_buffer_size);
+        }
+    }
+
+    // Index of the shard owning the event's book, -1 when the event names no valid symbol.
+    // New orders carry their symbol, cancels and updates find it in the order id
+    int route(const Event &event)
+    {
+        const bool is_order = (event.command == bid_command || event.command == ask_command);
+        const uint32_t symbol = is_order ? event.symbol : uint32_t(uint64_t(event.field_one) >> id_bits);
+
+        if (symbol >= symbol_count)
+            return -1;
+        return int(BookManager<>::shard_of(symbol, shards.size()));
+    }
+};
+
+// Per connection batching, picked on the command line. latency() writes each result as soon as the socket
+// is free, throughput() holds results back briefly so each write and each ring claim carries more of them
+struct session_options
+{
+    size_t max_batch;            // Most events published to a shard's ring with one claim
+    size_t max_write_bytes;      // Results are merged into one message up to this size
+    size_t max_queued_bytes;     // Reads pause while this much output waits for a slow client
+    std::chrono::microseconds flush_interval;  // How long results gather before a write, 0 for none
+
+    static session_options latency()
+    {
+        return {64, 16 * 1024, 1 << 20, std::chrono::microseconds(0)};
+    }
+
+    static session_options throughput()
+    {
+        return {1024, 256 * 1024, 16 << 20, std::chrono::microseconds(200)};
+    }
+};
+
+// Parses order commands from WebSocket messages into the pipeline and writes back results
 class session : public std::enable_shared_from_this<session>
 {
     websocket::stream<beast::tcp_stream> _ws;
     beast::flat_buffer _buffer;
+    pipeline& _pipeline;
+    const uint32_t _id;
+    const session_options _options;
+    bool _binary = false;  // Replies use the framing of the last message received
+    uint64_t _received = 0;  // latency_ticks() when the message being parsed was read
+
+    // Events parsed from the current message, per shard, each batch published with one ring claim.
+    // Binary messages are kept as pointers into the read buffer and decoded straight into their slots
+    std::vector<std::vector<Event>> _text_batches;
+    std::vector<std::vector<const unsigned char*>> _binary_batches;
+
+    // Binary responses and market data records differ in size, so they never share a message
+    enum class frame_kind : uint8_t { text, binary_responses, binary_market_data };
+    struct outgoing { std::string bytes; frame_kind kind; };
+
+    // Output waiting to be written, only touched on the session's strand. Results are appended to the last
+    // message not yet being written, so everything produced while a write is in flight goes out as one write
+    std::deque<outgoing> _outbox;
+    size_t _queued_bytes = 0;
+    bool _writing = false;      // The front of the outbox is being written
+    bool _flush_armed = false;  // The flush timer will start the next write
+    bool _read_paused = false;  // Too much output is queued, on_write resumes reading
+    net::steady_timer _flush_timer;
+
+    // Market data waiting to be written, filled by the fan-out thread. Levels and quotes are conflated,
+    // so a client which reads slowly gets the latest quantity at each price rather than every change
+    std::mutex _md_mutex;
+    std::unordered_map<uint32_t, uint32_t> _md_depth;   // Subscribed symbols and their depth
+    std::map<uint64_t, MarketDataEvent> _md_levels;     // Keyed by symbol, kind, side and price
+    std::deque<MarketDataEvent> _md_prints;
+    bool _md_flush_posted = false;  // A flush is queued on the strand or waiting for the outbox to drain
+    bool _md_waiting = false;       // Strand only, the flush is waiting for the write in flight to finish
+
+    static constexpr size_t max_pending_prints = 4096;
 
 public:
-    // Take ownership of the socket
-    explicit session(tcp::socket&& socket) : _ws(std::move(socket)) {}
+    // Take ownership of the socket, the session id doubles as the trader id of its orders
+    session(tcp::socket&& socket, pipeline& p, const session_options& options)
+        : _ws(std::move(socket)), _pipeline(p), _id(p.next_session_id++), _options(options),
+          _text_batches(p.shards.size()), _binary_batches(p.shards.size()), _flush_timer(_ws.get_executor()) {}
+
+    ~session()
+    {
+        _pipeline.sessions.remove(_id);
+    }
 
     // Get on the correct executor
     void run()
@@ -93,6 +355,8 @@ public:
         if(ec)
             return fail(ec, "accept");
 
+        _pipeline.sessions.add(_id, weak_from_this());
+
         // Read a message
         do_read();
     }
@@ -120,30 +384,337 @@ public:
         if(ec)
             return fail(ec, "read");
 
-        // Parse buffer data to get commands for 
+        // Parse buffer data into events for the matcher
+        _received = latency_ticks();
+        parse_buffer();
 
+        // Clear the buffer
+        _buffer.consume(_buffer.size());
+
+        // Reads carry on while results are written back independently, unless the client isn't reading them
+        if (_queued_bytes >= _options.max_queued_bytes) {
+            _read_paused = true;
+            return;
+        }
+        do_read();
+    }
+
+    void parse_buffer() {
+        _binary = !_ws.got_text();
+
+        if (_binary)
+            parse_binary();
+        else
+            parse_text();
+    }
+
+    void parse_text() {
+        // One command per line, see parse_command for the format
+        std::string buffer_data = beast::buffers_to_string(_buffer.data());
+
+        for (const std::string &line : split(buffer_data, '\n')) {
+            Event event;
+
+            if (!parse_command(line, event)) {
+                queue_write({'X', -1, 0, 0, _id});
+                continue;
+            }
+
+            if (event.command == subscribe_command) {
+                subscribe(event.symbol, event.field_one);
+                continue;
+            }
+
+            if (event.command == stats_command) {
+                write_stats();
+                continue;
+            }
+
+            if (event.command == top_command) {
+                write_top(event.symbol);
+                continue;
+            }
 
-        // Echo the message
-        _ws.text(_ws.got_text());
+            const int target = _pipeline.route(event);
+            if (target < 0) {
+                queue_write({'X', -1, 0, 0, _id});
+                continue;
+            }
+
+            event.trader_id = _id;
+            event.session_id = _id;
+            _text_batches[target].push_back(event);
+            if (_text_batches[target].size() == _options.max_batch)
+                publish_text(target);
+        }
+
+        for (size_t target = 0; target < _text_batches.size(); target++)
+            publish_text(target);
+    }
+
+    void parse_binary() {
+        // A flat_buffer is always one contiguous region, messages are copied from it straight into ring slots
+        const auto data = _buffer.data();
+        const unsigned char *bytes = static_cast<const unsigned char*>(data.data());
+
+        if (data.size() % wire_event_size != 0) {
+            queue_write({'X', -1, 0, 0, _id});
+            return;
+        }
+
+        for (size_t offset = 0; offset < data.size(); offset += wire_event_size) {
+            const unsigned char *message = bytes + offset;
+
+            Event header;
+            int target = -1;
+            if (valid_wire_event(message)) {
+                decode_event(message, header);
+                if (header.command == subscribe_command) {
+                    subscribe(header.symbol, header.field_one);
+                    continue;
+                }
+                target = _pipeline.route(header);
+            }
+
+            if (target < 0) {
+                queue_write({'X', -1, 0, 0, _id});
+                continue;
+            }
+
+            _binary_batches[target].push_back(message);
+            if (_binary_batches[target].size() == _options.max_batch)
+                publish_binary(target);
+        }
+
+        // Published before the read buffer is consumed, the batches point into it
+        for (size_t target = 0; target < _binary_batches.size(); target++)
+            publish_binary(target);
+    }
+
+    void publish_text(size_t target)
+    {
+        std::vector<Event> &batch = _text_batches[target];
+        if (batch.empty())
+            return;
+
+        _pipeline.shards[target]->publish(batch.size(), _received,
+            [&batch](Event &slot, size_t i) { slot = batch[i]; });
+        for (size_t i = 0; i < batch.size(); i++)
+            record_latency(LatencyStage::receive, _received);
+        batch.clear();
+    }
+
+    void publish_binary(size_t target)
+    {
+        std::vector<const unsigned char*> &batch = _binary_batches[target];
+        if (batch.empty())
+            return;
+
+        _pipeline.shards[target]->publish(batch.size(), _received,
+            [this, &batch](Event &slot, size_t i)
+            {
+                decode_event(batch[i], slot);
+                slot.trader_id = _id;
+                slot.session_id = _id;
+            });
+        for (size_t i = 0; i < batch.size(); i++)
+            record_latency(LatencyStage::receive, _received);
+        batch.clear();
+    }
+
+    // A symbol's best levels as last published by its matcher, read without going through the matcher
+    void write_top(uint32_t symbol)
+    {
+        if (symbol >= _pipeline.symbol_count) {
+            queue_write({'X', -1, 0, 0, _id});
+            return;
+        }
+
+        const server_top top = _pipeline.tops[symbol].load();
+        std::string message;
+        for (uint32_t i = 0; i < top.bid_levels; i++)
+            message += "D " + std::to_string(symbol) + " B " + std::to_string(top.bid_prices[i]) + " " + std::to_string(top.bid_quantities[i]) + "\n";
+        for (uint32_t i = 0; i < top.ask_levels; i++)
+            message += "D " + std::to_string(symbol) + " A " + std::to_string(top.ask_prices[i]) + " " + std::to_string(top.ask_quantities[i]) + "\n";
+        message += "D " + std::to_string(symbol) + "\n";
+
+        enqueue(message, frame_kind::text);
+    }
+
+    // Every thread's histograms merged, one line per stage
+    void write_stats()
+    {
+        std::string message;
+        for (size_t stage = 0; stage < size_t(LatencyStage::count); stage++) {
+            const LatencySummary summary = LatencyStats::instance().summary(LatencyStage(stage));
+            message += "H " + std::string(latency_stage_names[stage]) + " " + std::to_string(summary.count) + " " + std::to_string(summary.p50)
+                + " " + std::to_string(summary.p99) + " " + std::to_string(summary.p999) + " " + std::to_string(summary.max) + "\n";
+        }
+
+        enqueue(message, frame_kind::text);
+    }
+
+    void subscribe(uint32_t symbol, uint32_t depth)
+    {
+        if (symbol >= _pipeline.symbol_count || depth < 1 || depth > 2) {
+            queue_write({'X', -1, 0, 0, _id});
+            return;
+        }
+
+        bool added;
+        {
+            std::lock_guard<std::mutex> lock(_md_mutex);
+            added = (_md_depth.count(symbol) == 0);
+            _md_depth[symbol] = depth;
+        }
+        if (added)
+            _pipeline.market_data.subscribe(symbol, weak_from_this());
+
+        queue_write({'S', int32_t(symbol), 0, depth, _id});
+    }
+
+    // Merges one market data event into the pending state, called by the fan-out thread
+    void publish_market_data(const MarketDataEvent &event)
+    {
+        std::lock_guard<std::mutex> lock(_md_mutex);
+
+        auto it = _md_depth.find(event.symbol);
+        if (it == _md_depth.end() || (event.kind == 'L' && it->second != 2) || (event.kind == 'Q' && it->second != 1))
+            return;
+
+        if (event.kind == 'P') {
+            if (_md_prints.size() == max_pending_prints)
+                _md_prints.pop_front();
+            _md_prints.push_back(event);
+        } else {
+            // Quotes are one slot per side, levels one per price
+            const uint32_t price_key = (event.kind == 'Q') ? 0 : uint32_t(event.price);
+            const uint64_t key = (uint64_t(event.symbol) << 48) | (uint64_t(uint8_t(event.kind)) << 40) | (uint64_t(uint8_t(event.side)) << 32) | price_key;
+            _md_levels[key] = event;
+        }
+
+        if (!_md_flush_posted) {
+            _md_flush_posted = true;
+            net::post(_ws.get_executor(),
+                [self = shared_from_this()]()
+                {
+                    self->flush_market_data();
+                });
+        }
+    }
+
+    // Writes everything pending as one message. While the socket is busy it waits for the current write to
+    // finish, conflating whatever arrives meanwhile, then queues behind the results already waiting
+    void flush_market_data()
+    {
+        if (!_outbox.empty()) {
+            _md_waiting = true;
+            return;
+        }
+        write_market_data();
+    }
+
+    void write_market_data()
+    {
+        std::map<uint64_t, MarketDataEvent> levels;
+        std::deque<MarketDataEvent> prints;
+        {
+            std::lock_guard<std::mutex> lock(_md_mutex);
+            levels.swap(_md_levels);
+            prints.swap(_md_prints);
+            _md_flush_posted = false;
+        }
+
+        std::string message;
+        for (const auto &level : levels) {
+            if (_binary)
+                message.append(reinterpret_cast<const char*>(&level.second), sizeof(MarketDataEvent));
+            else
+                format_market_data(level.second, message);
+        }
+        for (const MarketDataEvent &print : prints) {
+            if (_binary)
+                message.append(reinterpret_cast<const char*>(&print), sizeof(MarketDataEvent));
+            else
+                format_market_data(print, message);
+        }
+
+        if (message.empty())
+            return;
+        enqueue(message, _binary ? frame_kind::binary_market_data : frame_kind::text);
+    }
+
+    // Queue a result for this session, safe to call from any thread
+    void send(const Response &response)
+    {
+        net::post(_ws.get_executor(),
+            [self = shared_from_this(), response]()
+            {
+                self->queue_write(response);
+            });
+    }
+
+    void queue_write(const Response &response)
+    {
+        // Formatting happens here on the session's strand rather than on the responder thread.
+        // Text results are one per line, so several can share a message
+        if(_binary) {
+            std::string message;
+            encode_response(response, message);
+            enqueue(message, frame_kind::binary_responses);
+        } else {
+            enqueue(format_response(response) + "\n", frame_kind::text);
+        }
+    }
+
+    // Appends to the last message waiting to be written when the framing and max_write_bytes allow,
+    // otherwise starts a new one
+    void enqueue(const std::string& bytes, frame_kind kind)
+    {
+        const size_t unsent = _outbox.size() - (_writing ? 1 : 0);
+        if (unsent > 0 && _outbox.back().kind == kind && _outbox.back().bytes.size() + bytes.size() <= _options.max_write_bytes)
+            _outbox.back().bytes += bytes;
+        else
+            _outbox.push_back({bytes, kind});
+        _queued_bytes += bytes.size();
+
+        schedule_write();
+    }
+
+    // Only one write may be outstanding, on_write picks up the rest. With a flush interval the first result
+    // waits on the timer so the ones which follow it can join the same write
+    void schedule_write()
+    {
+        if (_writing || _flush_armed)
+            return;
+
+        if (_options.flush_interval.count() == 0) {
+            do_write();
+            return;
+        }
+
+        _flush_armed = true;
+        _flush_timer.expires_after(_options.flush_interval);
+        _flush_timer.async_wait(
+            [self = shared_from_this()](beast::error_code ec)
+            {
+                self->_flush_armed = false;
+                if (!ec)
+                    self->do_write();
+            });
+    }
+
+    void do_write()
+    {
+        _writing = true;
+        _ws.text(_outbox.front().kind == frame_kind::text);
         _ws.async_write(
-            _buffer.data(),
+            net::buffer(_outbox.front().bytes),
             beast::bind_front_handler(
                 &session::on_write,
                 shared_from_this()));
     }
 
-    void parse_buffer(beast::error_code ec) {
-        // Call the requisite function
-        // Bid = B {quantity} {price}
-        // Ask = A {quantity} {price}
-        // Cancel = C {id}
-        // Update = U {id} {quantity}
-        // 
-        std::string buffer_data(net::buffers_begin(_buffer), net::buffers_begin(_buffer) + _buffer.data().size());
-        // Write data to ringbuff
-        
-    }
-
     void on_write(
         beast::error_code ec,
         std::size_t bytes_transferred)
@@ -153,11 +724,25 @@ public:
         if(ec)
             return fail(ec, "write");
 
-        // Clear the buffer
-        _buffer.consume(_buffer.size());
+        _queued_bytes -= _outbox.front().bytes.size();
+        _outbox.pop_front();
+        _writing = false;
 
-        // Do another read
-        do_read();
+        if (_read_paused && _queued_bytes < _options.max_queued_bytes) {
+            _read_paused = false;
+            do_read();
+        }
+
+        // Anything queued meanwhile has already waited for this write, so it goes straight out
+        if(!_outbox.empty())
+            do_write();
+
+        // Waiting market data is queued after every write rather than once the outbox drains, which it
+        // never does while results keep arriving
+        if(_md_waiting) {
+            _md_waiting = false;
+            write_market_data();
+        }
     }
 };
 
@@ -166,12 +751,16 @@ class listener : public std::enable_shared_from_this<listener>
 {
     net::io_context& _ioc;
     tcp::acceptor _acceptor;
+    pipeline& _pipeline;
+    const session_options _options;
 
 public:
     listener(
         net::io_context& ioc,
-        tcp::endpoint endpoint
-    ) : _ioc(ioc), _acceptor(ioc)
+        tcp::endpoint endpoint,
+        pipeline& p,
+        const session_options& options
+    ) : _ioc(ioc), _acceptor(ioc), _pipeline(p), _options(options)
     {
         beast::error_code ec;
 
@@ -221,117 +810,553 @@ private:
         );
     }
 
-    void on_accept(tcp::socket socket, beast::error_code ec) {
+    void on_accept(beast::error_code ec, tcp::socket socket) {
         if (ec) {
             fail(ec, "accept");
         } else {
-            std::make_shared<session>(std::move(socket))->run();
+            std::make_shared<session>(std::move(socket), _pipeline, _options)->run();
         }
 
         do_accept();
     }
 };
 
-struct Event {
-    uint8_t command;
-    uint32_t field_one;
-    uint32_t field_two;
-    OrderType order_type;
-    uint32_t trader_id;
-}
+// Applies one event to a shard's books, passing each result to respond.
+// Shared by the matcher and journal replay, so a replayed shard ends up exactly where the matcher left it.
+// market_data is then given the touched book, whose sink holds the event's fills and level updates
+template <typename Respond, typename MarketData>
+void apply_event(BookManager<server_book>& books, const Event& event, Respond&& respond, MarketData&& market_data) {
+    int order_id = -1;
+
+    // Call LOB functions
+    switch (event.command) {
+        case bid_command:
+            order_id = books.bid(event.symbol, event.field_one, event.field_two, event.order_type, event.trader_id);
+            respond({(order_id >= 0) ? 'O' : 'X', order_id, event.field_two, event.field_one, event.session_id});
+            break;
+        case ask_command:
+            order_id = books.ask(event.symbol, event.field_one, event.field_two, event.order_type, event.trader_id);
+            respond({(order_id >= 0) ? 'O' : 'X', order_id, event.field_two, event.field_one, event.session_id});
+            break;
+        case cancel_command:
+            respond({books.cancel(event.field_one, event.trader_id) ? 'C' : 'X', int32_t(event.field_one), 0, 0, event.session_id});
+            break;
+        case update_command:
+            respond({books.update(event.field_one, event.field_two, event.trader_id) ? 'U' : 'X', int32_t(event.field_one), 0, event.field_two, event.session_id});
+            break;
+        case replace_command:
+            order_id = books.replace(event.field_one, event.field_two, event.field_three, event.trader_id);
+            respond({(order_id >= 0) ? 'R' : 'X', int32_t(event.field_one), event.field_two, event.field_three, event.session_id});
+            break;
+    }
 
+    // Only new orders and replaces can match. Trader ids are session ids, so each fill goes to both the taker and the maker,
+    // each with the id of their own order.
+    // The sink is drained after every event so it only ever holds one event's fills and level updates
+    const bool is_order = (event.command == bid_command || event.command == ask_command);
+    const uint32_t symbol = is_order ? event.symbol : books.symbol_of(int(event.field_one));
+    server_book *lob = books.find(symbol);
+    if (lob != nullptr) {
+        for (const Transaction &transaction : lob->get_fill_sink().transactions) {
+            respond({'T', books.to_global(symbol, transaction.taker_order_id), uint32_t(transaction.price), uint32_t(transaction.quantity), uint32_t(transaction.trader_one)});
+            respond({'T', books.to_global(symbol, transaction.maker_order_id), uint32_t(transaction.price), uint32_t(transaction.quantity), uint32_t(transaction.trader_two)});
+        }
+        market_data(symbol, *lob);
+        lob->get_fill_sink().clear();
+    }
+}
 
-void consumer(
-    &disruptorplus::ring_buffer<Event> buffer,
-    &disriptorplus::spin_wait_strategy wait_strategy, 
-    &disruptorplus::multi_threaded_claim_strategy<disruptorplus::spin_wait_strategy> claim_strategy,
-    &disruptorplus::sequence_barrier<disruptorplus::spin_wait_strategy> consumed
-) {
+// Applies one shard's events to its books in sequence order and publishes their results, market data and
+// the top of each book it changed
+void consumer(shard& p, BookManager<server_book>& books, Seqlock<server_top>* tops) {
     // Setup
-    LimitOrderBook lob();
     disruptorplus::sequence_t next_to_read = 0;
+    disruptorplus::sequence_t last_response = p.response_claim_strategy.last_published();
+    disruptorplus::sequence_t last_market_data = p.market_data_claim_strategy.last_published();
+
+    const size_t times_mask = p.times.size() - 1;
+    const size_t market_data_mask = p.market_data_events.size() - 1;
+
+    // Results are normally released once per batch, but a single event can produce more of them than a ring
+    // holds (an ack plus two responses per fill of a deep sweep). Claimed slots are only reused once they are
+    // published and read, so each ring is also released whenever half of it is claimed but unpublished
+    const size_t response_flush = p.responses.size() / 2;
+    const size_t market_data_flush = p.market_data.size() / 2;
+    size_t unpublished_responses = 0;
+    size_t unpublished_market_data = 0;
+
+    auto respond = [&](const Response &response) {
+        if (unpublished_responses == response_flush) {
+            p.response_claim_strategy.publish(last_response);
+            unpublished_responses = 0;
+        }
+        last_response = p.response_claim_strategy.claim_one();
+        unpublished_responses++;
+        p.responses[last_response] = response;
+        p.responses[last_response].event_sequence = next_to_read;
+        p.responses[last_response].received = p.times[next_to_read & times_mask].received;
+        if (response.kind == 'T')
+            record_latency(LatencyStage::fill, p.times[next_to_read & times_mask].received);
+    };
+
+    auto publish_market_data = [&](const MarketDataEvent &event) {
+        if (unpublished_market_data == market_data_flush) {
+            p.market_data_claim_strategy.publish(last_market_data);
+            unpublished_market_data = 0;
+        }
+        last_market_data = p.market_data_claim_strategy.claim_one();
+        unpublished_market_data++;
+        p.market_data[last_market_data] = event;
+        p.market_data_events[last_market_data & market_data_mask] = next_to_read;
+    };
+
+    // Last top of book sent per symbol, bid price, bid quantity, ask price, ask quantity. An empty side is 0 0
+    std::vector<std::array<int32_t, 4>> quotes(books.get_symbol_count(), std::array<int32_t, 4>{0, 0, 0, 0});
+
+    // Symbols whose levels changed during the current batch, their tops are published once per batch
+    std::vector<uint32_t> touched;
+    std::vector<bool> is_touched(books.get_symbol_count(), false);
+    server_top top;
+
+    auto market_data = [&](uint32_t symbol, server_book &lob) {
+        const MarketDataSink &sink = lob.get_fill_sink();
+        if (sink.level_updates.empty())
+            return;
+
+        if (!is_touched[symbol]) {
+            is_touched[symbol] = true;
+            touched.push_back(symbol);
+        }
+
+        for (const LevelUpdate &update : sink.level_updates)
+            publish_market_data({'L', update.is_bid ? 'B' : 'A', uint16_t(symbol), update.price, update.quantity});
+        for (const Transaction &transaction : sink.transactions)
+            publish_market_data({'P', 0, uint16_t(symbol), transaction.price, transaction.quantity});
+
+        // Every change to the top of book shows up as a level update, so quotes are only checked then
+        std::array<int32_t, 4> quote{0, 0, 0, 0};
+        int price, quantity;
+        if (lob.depth(true, 1, &price, &quantity) == 1)
+            quote[0] = price, quote[1] = quantity;
+        if (lob.depth(false, 1, &price, &quantity) == 1)
+            quote[2] = price, quote[3] = quantity;
+
+        if (quote[0] != quotes[symbol][0] || quote[1] != quotes[symbol][1])
+            publish_market_data({'Q', 'B', uint16_t(symbol), quote[0], quote[1]});
+        if (quote[2] != quotes[symbol][2] || quote[3] != quotes[symbol][3])
+            publish_market_data({'Q', 'A', uint16_t(symbol), quote[2], quote[3]});
+        quotes[symbol] = quote;
+    };
 
     while (true) {
         // Consume stuff from disruptor
-        disruptorplus::sequence_t available = claim_strategy.wait_until_published(next_to_read);
+        disruptorplus::sequence_t available = p.event_claim_strategy.wait_until_published(next_to_read, next_to_read - 1);
+
+        const uint64_t dequeued = latency_ticks();
 
         do {
-            auto& event = buffer[next_to_read];
-            // Call LOB functions
-            switch (event.command) {
-                case 0:
-                    lob.bid(event.field_one, event.field_two, event.order_type, event.trader_id);
-                    break;
-                case 1:
-                    lob.ask(event.field_one, event.field_two, event.order_type, event.trader_id);
-                    break;
-                case 2:
-                    lob.cancel(event.field_one, event.trader_id);
-                    break;
-                case 3:
-                    lob.update(event.field_one, event.field_two, event.trader_id);
-                    break;
+            const uint64_t started = latency_ticks();
+            apply_event(books, p.events[next_to_read], respond, market_data);
+
+            if constexpr (latency_stats_enabled) {
+                LatencyStats::instance().record(LatencyStage::queue, p.times[next_to_read & times_mask].published, dequeued);
+                record_latency(LatencyStage::match, started);
             }
         } while (next_to_read++ != available);
 
-        consumed.publish(available);
+        for (const uint32_t symbol : touched) {
+            capture_top_of_book(*books.find(symbol), available, top);
+            tops[symbol].store(top);
+            is_touched[symbol] = false;
+        }
+        touched.clear();
+
+        // Release the batch to the producers, the responder and the fan-out thread
+        p.events_consumed.publish(available);
+        p.response_claim_strategy.publish(last_response);
+        p.market_data_claim_strategy.publish(last_market_data);
+        unpublished_responses = 0;
+        unpublished_market_data = 0;
     }
 }
 
+// Appends one shard's events to its journal alongside the matcher.
+// Everything published since the last pass is written and synced as one group commit, so the sync cost
+// is shared by the whole batch and the matcher never waits on the disk.
+// If the journal can't be written or synced the server stops: results are only sent once their event is
+// journaled, so nothing from the failed batch onwards has been acknowledged
+void journaller(shard& p, JournalWriter<Event>& journal) {
+    disruptorplus::sequence_t next_to_read = 0;
+    const size_t mask = p.events.size() - 1;
 
-int main() {
-    const size_t buffer_size = 8192; // Must be power-of-two, set higher for higher throughput
-    
-    disruptorplus::ring_buffer<Event> buffer(buffer_size);
-    
-    disruptorplus::spin_wait_strategy wait_strategy;
-    disruptorplus::multi_threaded_claim_strategy<disruptorplus::spin_wait_strategy> claim_strategy(buffer_size, wait_strategy);
-    disruptorplus::sequence_barrier<disruptorplus::spin_wait_strategy> consumed(wait_strategy);
-    claim_strategy.add_claim_barrier(consumed);
+    while (true) {
+        disruptorplus::sequence_t available = p.event_claim_strategy.wait_until_published(next_to_read, next_to_read - 1);
+
+        try {
+            // The batch may wrap around the end of the ring
+            while (next_to_read != available + 1) {
+                const size_t first = next_to_read & mask;
+                const size_t count = std::min<size_t>(available + 1 - next_to_read, p.events.size() - first);
+                journal.append(&p.events[next_to_read], count);
+                next_to_read += count;
+            }
+            journal.commit();
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Journal failed, shutting down: " << e.what() << "\n";
+            std::_Exit(EXIT_FAILURE);
+        }
+
+        p.events_journaled.publish(available);
+    }
+}
+
+// Routes results from one shard's matcher to their sessions, once the events behind them are journaled
+void responder(shard& p, session_registry& sessions) {
+    disruptorplus::sequence_t next_to_read = 0;
+    disruptorplus::sequence_t journaled = p.events_journaled.last_published();
+
+    while (true) {
+        disruptorplus::sequence_t available = p.response_claim_strategy.wait_until_published(next_to_read);
+
+        do {
+            const Response& response = p.responses[next_to_read];
+
+            if (disruptorplus::difference(response.event_sequence, journaled) > 0)
+                journaled = p.events_journaled.wait_until_published(response.event_sequence);
+
+            // Sessions which have disconnected are dropped from the registry
+            if (std::shared_ptr<session> s = sessions.find(response.session_id)) {
+                s->send(response);
+            }
+            record_latency(LatencyStage::reply, response.received);
+        } while (next_to_read++ != available);
+
+        p.responses_consumed.publish(available);
+    }
+}
+
+// Hands one shard's market data to each subscribed session, which conflates it until its socket is free.
+// Like responses, nothing goes out before the events behind it are journaled
+void market_data_fanout(shard& p, market_data_hub& hub) {
+    disruptorplus::sequence_t next_to_read = 0;
+
+    while (true) {
+        disruptorplus::sequence_t available = p.market_data_claim_strategy.wait_until_published(next_to_read);
+
+        // Slots hold events in sequence order, so the last one's event covers the whole batch
+        p.events_journaled.wait_until_published(p.market_data_events[available & (p.market_data_events.size() - 1)]);
+
+        do {
+            const MarketDataEvent& event = p.market_data[next_to_read];
+            hub.for_each_subscriber(event.symbol, [&](session& s) { s.publish_market_data(event); });
+        } while (next_to_read++ != available);
+
+        p.market_data_consumed.publish(available);
+    }
+}
+
+// Keeps a thread on one core, so a matcher's books stay in that core's caches and the scheduler can't move
+// it onto a core other processes are using
+void pin_to_core(pthread_t thread, size_t core, const char* role) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (core < CPU_SETSIZE)
+        CPU_SET(core, &cpus);
+
+    if (core >= CPU_SETSIZE || pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpus) != 0)
+        std::cerr << "Could not pin " << role << " to core " << core << "\n";
+}
+
+// Needs CAP_SYS_NICE or an RLIMIT_RTPRIO of at least priority. A spinning SCHED_FIFO thread never gives
+// its core up, so only use it on cores kept free for the matchers
+void set_fifo_priority(pthread_t thread, int priority, const char* role) {
+    sched_param param{};
+    param.sched_priority = priority;
+
+    if (pthread_setschedparam(thread, SCHED_FIFO, &param) != 0)
+        std::cerr << "Could not give " << role << " SCHED_FIFO priority " << priority << "\n";
+}
+
+// Settings taken from the command line, see usage()
+struct server_config
+{
+    bool replay_only = false;
+    size_t matchers = 2;                 // Shards, each with one matcher thread pinned to its own core
+    uint32_t symbols = 256;              // Symbol ids 0 to symbols - 1
+    session_options session = session_options::latency();
+    WaitMode wait_mode = WaitMode::spin;
+    size_t ring_size = 8192;             // Event slots per shard, a power of two, results get 8 times as many
+    unsigned short port = 8080;
+    int io_threads = 8;
+    std::vector<size_t> matcher_cores;   // Matcher i runs on matcher_cores[i], on core i when empty, one per matcher
+    std::vector<size_t> io_cores;        // I/O thread i runs on io_cores[i % size], unpinned when empty
+    int fifo_priority = 0;               // SCHED_FIFO priority for the matchers, 0 leaves them SCHED_OTHER
+    bool lock_memory = false;            // mlockall so no page is swapped out or first touched late
+    size_t orders_per_book = 4096;       // Pools reserved, and so faulted in, for each book at startup
+    size_t levels_per_book = 256;
+};
+
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [replay|latency|throughput] [options]\n"
+        << "  --matchers N              matcher threads, symbols are shared out between them (2)\n"
+        << "  --symbols N               symbol ids 0 to N - 1, up to 65536 (256)\n"
+        << "  --wait spin|yield|block   how threads wait on the rings (spin)\n"
+        << "  --ring-size N             event slots per shard, a power of two, caps the batch size (8192)\n"
+        << "  --port N                  (8080)\n"
+        << "  --io-threads N            (8)\n"
+        << "  --matcher-cores A,B       core for each matcher, also sets --matchers (0,1)\n"
+        << "  --io-cores A,B,...        cores shared out between the I/O threads (unpinned)\n"
+        << "  --fifo PRIORITY           run the matchers under SCHED_FIFO (off)\n"
+        << "  --mlock                   lock all current and future memory (off)\n"
+        << "  --orders-per-book N       order pool reserved per book (4096)\n"
+        << "  --levels-per-book N       level pool reserved per book (256)\n";
+}
+
+// False on --help or anything malformed, after saying what
+bool parse_config(int argc, char* argv[], server_config& config) {
+    int i = 1;
+    auto value = [&]() -> std::string {
+        if (i + 1 >= argc)
+            throw std::invalid_argument(std::string(argv[i]) + " needs a value");
+        return argv[++i];
+    };
+    auto to_number = [](const std::string& text) -> size_t {
+        try {
+            return std::stoul(text);
+        } catch (const std::exception&) {
+            throw std::invalid_argument("Malformed number " + text);
+        }
+    };
+    auto number = [&]() { return to_number(value()); };
+    // hardware_concurrency is 0 when unknown, then only pinning itself can fail
+    const size_t core_count = std::thread::hardware_concurrency();
+    auto cores = [&](std::vector<size_t>& list) {
+        list.clear();
+        for (const std::string& core : split(value(), ',')) {
+            list.push_back(to_number(core));
+            if (list.back() >= CPU_SETSIZE || (core_count > 0 && list.back() >= core_count))
+                throw std::invalid_argument("No core " + core + " on this machine");
+        }
+        if (list.empty())
+            throw std::invalid_argument("No cores given");
+    };
+    bool matchers_given = false;
+
+    try {
+        for (; i < argc; i++) {
+            const std::string arg = argv[i];
+
+            if (arg == "--help")
+                return false;
+            else if (arg == "replay")
+                config.replay_only = true;
+            else if (arg == "latency")
+                config.session = session_options::latency();
+            else if (arg == "throughput")
+                config.session = session_options::throughput();
+            else if (arg == "--matchers") {
+                config.matchers = number();
+                matchers_given = true;
+            } else if (arg == "--symbols") {
+                const size_t symbols = number();
+                if (symbols == 0 || symbols > (size_t(1) << 16))
+                    throw std::invalid_argument("Symbols must be 1 to 65536");
+                config.symbols = uint32_t(symbols);
+            } else if (arg == "--wait") {
+                const std::string mode = value();
+                if (mode == "spin")
+                    config.wait_mode = WaitMode::spin;
+                else if (mode == "yield")
+                    config.wait_mode = WaitMode::yield;
+                else if (mode == "block")
+                    config.wait_mode = WaitMode::block;
+                else
+                    throw std::invalid_argument("Unknown wait strategy " + mode);
+            } else if (arg == "--ring-size") {
+                config.ring_size = number();
+                if (config.ring_size < 2 || (config.ring_size & (config.ring_size - 1)) != 0)
+                    throw std::invalid_argument("Ring size must be a power of two");
+            } else if (arg == "--port")
+                config.port = static_cast<unsigned short>(number());
+            else if (arg == "--io-threads")
+                config.io_threads = std::max(1, int(number()));
+            else if (arg == "--matcher-cores")
+                cores(config.matcher_cores);
+            else if (arg == "--io-cores")
+                cores(config.io_cores);
+            else if (arg == "--fifo")
+                config.fifo_priority = int(number());
+            else if (arg == "--mlock")
+                config.lock_memory = true;
+            else if (arg == "--orders-per-book")
+                config.orders_per_book = number();
+            else if (arg == "--levels-per-book")
+                config.levels_per_book = number();
+            else
+                throw std::invalid_argument("Unknown option " + arg);
+        }
+
+        // One core per matcher, so a list of cores is also the number of matchers
+        if (!config.matcher_cores.empty()) {
+            if (matchers_given && config.matchers != config.matcher_cores.size())
+                throw std::invalid_argument("--matcher-cores lists " + std::to_string(config.matcher_cores.size()) + " cores for "
+                    + std::to_string(config.matchers) + " matchers");
+            config.matchers = config.matcher_cores.size();
+        }
+        // A batch is published with one claim, which can't take more slots than the ring has
+        config.session.max_batch = std::min(config.session.max_batch, config.ring_size);
+
+        // Every shard needs a symbol, and journal tags hold the shard count in 16 bits
+        if (config.matchers == 0 || config.matchers > config.symbols || config.matchers > UINT16_MAX)
+            throw std::invalid_argument("Matchers must be 1 to the number of symbols (" + std::to_string(config.symbols) + ")");
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Journals are only valid for the shard layout that wrote them
+uint64_t journal_tag(size_t shard, size_t shard_count, uint32_t symbol_count) {
+    return (uint64_t(symbol_count) << 32) | (uint64_t(shard_count) << 16) | shard;
+}
+
+std::string journal_path(size_t shard) {
+    return "journal_" + std::to_string(shard) + ".bin";
+}
+
+// Rebuilds a shard's books from the events committed to its journal.
+// Session ids are trader ids, so new sessions must be numbered after every session seen in the journal
+uint64_t replay(BookManager<server_book>& books, size_t shard, size_t shard_count, uint32_t symbol_count, uint32_t& next_session_id) {
+    JournalReader<Event> journal(journal_path(shard), journal_tag(shard, shard_count, symbol_count));
+    journal.for_each([&](const Event& event) {
+        apply_event(books, event, [](const Response&) {}, [](uint32_t, server_book&) {});
+        next_session_id = std::max(next_session_id, event.session_id + 1);
+    });
+    return journal.size();
+}
+
+// tests/server_tests.cpp includes this file with WS_SERVER_NO_MAIN to drive the shards directly
+#ifndef WS_SERVER_NO_MAIN
+
+// A journal that can't be opened or belongs to another layout stops the server before it serves anything
+int journal_error(const std::runtime_error& e) {
+    std::cerr << e.what() << "\n"
+              << "Journals only replay under the --matchers and --symbols they were written with, "
+              << "start with those or move the journal files aside\n";
+    return 1;
+}
+
+// Run with "replay" to rebuild every shard from its journal, report the time taken and exit.
+// Otherwise "latency" (the default) or "throughput" picks the session batching, see session_options,
+// and the options in usage() place and tune the threads
+int main(int argc, char* argv[]) {
+    server_config config;
+    if (!parse_config(argc, argv, config)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const size_t matchers = config.matchers;
+    const uint32_t symbols = config.symbols;
+
+    // Locked before the rings and pools are allocated, so MCL_FUTURE faults them all in as they are made
+    if (config.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        std::cerr << "Could not lock memory: " << std::strerror(errno) << "\n";
+
+    // Calibrate the latency clock now rather than on the first recorded event
+    latency_ns_per_tick();
+
+    // Each event produces an acknowledgement plus two responses per fill, so give results more room
+    pipeline p(matchers, symbols, config.ring_size, config.ring_size * 8, config.wait_mode);
+
+    // Recover each shard from its journal before accepting new events
+    std::vector<std::unique_ptr<BookManager<server_book>>> books;
+    uint32_t next_session_id = 0;
+    for (size_t i = 0; i < matchers; i++) {
+        // Reserving a pool writes through every slot of it, so the pools are faulted in here too
+        books.push_back(std::make_unique<BookManager<server_book>>(symbols, i, matchers, config.orders_per_book, config.levels_per_book));
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t replayed;
+        try {
+            replayed = replay(*books.back(), i, matchers, symbols, next_session_id);
+        } catch (const std::runtime_error& e) {
+            return journal_error(e);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << "Shard " << i << " replayed " << replayed << " events in " << seconds << "s\n";
+
+        // Matchers only publish tops for books an event changes, so start from the replayed books
+        books.back()->for_each([&p](uint32_t symbol, server_book& book) {
+            server_top top;
+            capture_top_of_book(book, 0, top);
+            p.tops[symbol].store(top);
+        });
+    }
+    p.next_session_id = next_session_id;
+
+    if (config.replay_only)
+        return 0;
+
+    std::vector<std::unique_ptr<JournalWriter<Event>>> journals;
+    try {
+        for (size_t i = 0; i < matchers; i++)
+            journals.push_back(std::make_unique<JournalWriter<Event>>(journal_path(i), journal_tag(i, matchers, symbols)));
+    } catch (const std::runtime_error& e) {
+        return journal_error(e);
+    }
 
     auto const address = net::ip::make_address("0.0.0.0");
-    const unsigned short port = 8080;
-    const int threads = 8;  // Number of threads
+    const int threads = config.io_threads;
 
     net::io_context ioc{threads};
 
-    std::make_shared<listener>(ioc, tcp::endpoint{address, port})->run();
+    std::make_shared<listener>(ioc, tcp::endpoint{address, config.port}, p, config.session)->run();
 
-    // Run the I/O service on the requested number of threads
+    // Run the I/O service on the requested number of threads, this one included
     std::vector<std::thread> v;
     v.reserve(threads - 1);
-    for(auto i = threads - 1; i > 0; --i)
+    for(auto i = threads - 1; i > 0; --i) {
         v.emplace_back(
         [&ioc]
         {
             ioc.run();
         });
+        if (!config.io_cores.empty())
+            pin_to_core(v.back().native_handle(), config.io_cores[v.size() % config.io_cores.size()], "I/O thread");
+    }
+
+    std::vector<std::thread> matcher_threads;
+    std::vector<std::thread> journal_threads;
+    std::vector<std::thread> responder_threads;
+    std::vector<std::thread> fanout_threads;
+    for (size_t i = 0; i < matchers; i++) {
+        matcher_threads.emplace_back(consumer, std::ref(*p.shards[i]), std::ref(*books[i]), p.tops.get());
+        const size_t core = config.matcher_cores.empty() ? i : config.matcher_cores[i];
+        pin_to_core(matcher_threads.back().native_handle(), core, "matcher");
+        if (config.fifo_priority > 0)
+            set_fifo_priority(matcher_threads.back().native_handle(), config.fifo_priority, "matcher");
+        journal_threads.emplace_back(journaller, std::ref(*p.shards[i]), std::ref(*journals[i]));
+        responder_threads.emplace_back(responder, std::ref(*p.shards[i]), std::ref(p.sessions));
+        fanout_threads.emplace_back(market_data_fanout, std::ref(*p.shards[i]), std::ref(p.market_data));
+    }
 
-    std::thread consumer(consumer, std::ref(buffer), std::ref(wait_strategy), std::ref(claim_strategy), std::ref(consumed));
+    // Pinned last, threads started from here would inherit its affinity
+    if (!config.io_cores.empty())
+        pin_to_core(pthread_self(), config.io_cores[0], "I/O thread");
 
     ioc.run();
-    consumer.join();
+    for (std::thread &t : matcher_threads)
+        t.join();
+    for (std::thread &t : journal_threads)
+        t.join();
+    for (std::thread &t : responder_threads)
+        t.join();
+    for (std::thread &t : fanout_threads)
+        t.join();
 
     return 0;
 }
 
-
-// switch (order_type_id) {
-//     case 0:
-//         order_type = OrderType.limit;
-//         break;
-//     case 1:
-//         order_type = OrderType.fill_and_kill;
-//         break;
-//     case 2:
-//         order_type = OrderType.market;
-//         break;
-//     case 3:
-//         order_type = OrderType.immediate_or_cancel;
-//         break;
-//     case 4:
-//         order_type = OrderType.post_only;
-//         break;
-//     default:
-//         order_type = OrderType.limit;
-// }
\ No newline at end of file
+#endif